@@ -17,223 +17,329 @@ AudioProcessor* JUCE_CALLTYPE createPluginFilter()
 }
 
 
-// Functions that compute the mappings of input pattern notes:
-namespace Mapping {
-
-  void mapToChordDegree(PatternNotesWraparound::Enum wrapMode,
-    const Chord& curChord,
-    int degreeNum,
-    Array<NoteNumber>& thisNoteMappings) {
-    int numChordDegrees = curChord.size();
-
-    if ((degreeNum < 0 || degreeNum >= numChordDegrees) &&
-      wrapMode == PatternNotesWraparound::NO_WRAPAROUND ||
-      numChordDegrees == 0)
-      return;
+void NoteEvents::computeNoteOnChans() {
+  // Same as Mapping::getNoteOnChan. A plain loop over arrays, which compilers
+  // vectorise
+  int n = size();
+  noteOnChans.resize(n);
+  const uint8* s = statuses.begin();
+  const uint8* nn = notes.begin();
+  NoteOnChan* out = noteOnChans.begin();
+  for (int i = 0; i < n; i++)
+    out[i] = nn[i] + (s[i] & 0x0f) * NumMidiNotes;
+}
 
-    int numValidDegrees =
-      (wrapMode <= PatternNotesWraparound::AFTER_ALL_CHORD_DEGREES)
-      ? numChordDegrees
-      : wrapMode;
-    int wantedDegree;
-    if (degreeNum >= 0)
-      wantedDegree = degreeNum % numValidDegrees;
-    else {
-      int absRem = (-degreeNum) % numValidDegrees;
-      wantedDegree = (absRem == 0) ? 0 : numValidDegrees - absRem;
-    }
-    int wantedOctaveShift = floor((float)degreeNum / (float)numValidDegrees);
 
-    if (wantedDegree < numChordDegrees)
-      thisNoteMappings.add(curChord[wantedDegree] + 12 * wantedOctaveShift);
-  }
+void Arp::readSettings() {
+  mSettings.behaviour = (InstanceBehaviour::Enum)instanceBehaviour->getIndex();
+  mSettings.whenNoChordNote = (WhenNoChordNote::Enum)whenNoChordNote->getIndex();
+  mSettings.whenSingleChordNote = (WhenSingleChordNote::Enum)whenSingleChordNote->getIndex();
+  mSettings.mapping.referenceNote = firstDegreeCode->getIndex();
+  mSettings.mapping.mappingMode = (PatternNotesMapping::Enum)patternNotesMapping->getIndex();
+  mSettings.mapping.wrapMode = (PatternNotesWraparound::Enum)patternNotesWraparound->getIndex();
+  mSettings.mapping.unmappedBeh = (UnmappedNotesBehaviour::Enum)unmappedNotesBehaviour->getIndex();
+  mSettings.sampleAccurate = eventTiming->getIndex() == EventTiming::SAMPLE_ACCURATE;
+  mSettings.chordBus = chordBus->getIndex();
+  mSettings.chordBusScope = (ChordBusScope::Enum)chordBusScope->getIndex();
+}
 
-  void mapPatternNote(NoteNumber referenceNote,
-    PatternNotesMapping::Enum mappingMode,
-    PatternNotesWraparound::Enum wrapMode,
-    UnmappedNotesBehaviour::Enum unmappedBeh,
-    const Chord& curChord,
-    NoteNumber noteCodeIn,
-    Array<NoteNumber>& thisNoteMappings) {
-    int offsetFromRef = noteCodeIn - referenceNote;
-
-    switch (mappingMode) {
-    case PatternNotesMapping::ALWAYS_LEAVE_UNMAPPED:
-      break;
-    case PatternNotesMapping::WHITE_NOTE_TO_DEGREE:
-      if (!MidiMessage::isMidiNoteBlack(noteCodeIn)) {
-        // We need to correct the [referenceNote,noteCodeIn] interval for the amount
-        // of black keys it contains:
-        int sign = (offsetFromRef < 0) ? -1 : 1;
-        int absOffset = sign * offsetFromRef;
-        for (int i = referenceNote; i != noteCodeIn; i += sign)
-          if (MidiMessage::isMidiNoteBlack(i))
-            absOffset--;
-        mapToChordDegree(wrapMode, curChord, sign * absOffset, thisNoteMappings);
-      }
-      break;
-    default:
-      mapToChordDegree(wrapMode, curChord, offsetFromRef, thisNoteMappings);
-      break;
-    }
 
-    if (thisNoteMappings.size() == 0) { // If the note has not been mapped yet:
-      switch (unmappedBeh) {
-      case UnmappedNotesBehaviour::SILENCE:
-        break;
-      case UnmappedNotesBehaviour::PLAY_FULL_CHORD_UP_TO_NOTE:
-        for (NoteNumber chdNote : curChord) {
-          if (chdNote <= noteCodeIn)
-            thisNoteMappings.add(chdNote);
-        }
-        break;
-      case UnmappedNotesBehaviour::TRANSPOSE_FROM_FIRST_DEGREE:
-        thisNoteMappings.add(curChord[0] + offsetFromRef);
-        break;
-      case UnmappedNotesBehaviour::USE_AS_IS:
-        thisNoteMappings.add(noteCodeIn);
-        break;
-      }
-    }
-  }
+void ArpMessageThreadUpdater::timerCallback() {
+  const ScopedLock lock(mLock);
+  for (auto* arp : mArps)
+    arp->handleParameterChanges();
+}
 
-  NoteOnChan getNoteOnChan(const MidiMessage& msg) {
-    return msg.getNoteNumber() | ((msg.getChannel() - 1) << 8);
-  }
 
-} // end namespace Mapping
+void Arp::updateLatency() {
+  int latency = 0;
+  if (instanceBehaviour->getIndex() == InstanceBehaviour::IS_CHORD)
+    latency = roundToInt(numMillisecsOfLatency->get() *
+      mSampleRate.load(std::memory_order_relaxed) / 1000);
+  // The host is only notified if the latency actually changed
+  setLatencySamples(latency);
+}
 
+String Arp::getStatusText() const {
+  // Only the instances that use a chord bus depend on the shared buses
+  if (instanceBehaviour->getIndex() >= InstanceBehaviour::IS_CHORD &&
+    chordBusScope->getIndex() == ChordBusScope::ALL_PROCESSES &&
+    !ChordBuses::getInstance()->areSharedBusesOpen())
+    return "The chord buses shared by all processes could not be opened. "
+           "Only the instances of this process share their chords";
+  return {};
+}
 
 void Arp::prepareToPlay(double sampleRate, int samplesPerBlock) {
-  auto behaviour = (InstanceBehaviour::Enum)instanceBehaviour->getIndex();
-
-  int latency = 0;
-  if (behaviour == InstanceBehaviour::IS_CHORD) {
-    int wanted = numMillisecsOfLatency->get();
-    latency = (samplesPerBlock * sampleRate * wanted) / 512000;
-  }
-  setLatencySamples(latency);
+  mSettingsChanged.store(false);
+  readSettings();
+  auto behaviour = mSettings.behaviour;
+
+  mSampleRate.store(sampleRate, std::memory_order_relaxed);
+  mLatencyDirty.store(false);
+  updateLatency();
+  openSharedChordBusesIfNeeded();
+
+  mPatternMapper.clear();
+
+  int scratchCapacity = jmax(MinScratchCapacity, samplesPerBlock);
+  mChordNoteOns.ensureStorageAllocated(scratchCapacity);
+  mChordNoteOffs.ensureStorageAllocated(scratchCapacity);
+  mPtrnNoteOns.ensureStorageAllocated(scratchCapacity);
+  mPtrnNoteOffs.ensureStorageAllocated(scratchCapacity);
+  mPtrnLateNoteOffs.ensureStorageAllocated(scratchCapacity);
+  mOtherMsgs.ensureStorageAllocated(scratchCapacity);
+  mPendingChordNotes.fill({});
+  mHasPendingChordNotes = false;
+  mOutBuffer.ensureSize((size_t)scratchCapacity * OutputBytesPerEvent);
 
   if (behaviour != InstanceBehaviour::IS_PATTERN)
     getChordStore(behaviour)->flushCurrentChord();
 }
 
+void Arp::updateBlockPosition() {
+  mBlockPosition = UnknownPosition;
+  if (auto* playHead = getPlayHead()) {
+    auto position = playHead->getPosition();
+    // When the transport is stopped, the position doesn't move, so it can't be
+    // used to order the chord changes and the pattern notes played live
+    if (position && position->getIsPlaying() && position->getTimeInSamples())
+      mBlockPosition = *position->getTimeInSamples();
+  }
+}
+
 void Arp::runArp(MidiBuffer& midibuf) {
-  auto behaviour = (InstanceBehaviour::Enum)instanceBehaviour->getIndex();
+  // The flag is only written when it is set, so that the blocks where no
+  // parameter changed don't pay for an atomic read-modify-write
+  if (mSettingsChanged.load(std::memory_order_relaxed) &&
+    mSettingsChanged.exchange(false, std::memory_order_acquire))
+    readSettings();
+
+  auto behaviour = mSettings.behaviour;
 
   if (behaviour == InstanceBehaviour::BYPASS)
     return;
-  else if (behaviour == InstanceBehaviour::IS_CHORD) {
+
+  bool sampleAccurate = mSettings.sampleAccurate;
+  updateBlockPosition();
+
+  if (behaviour == InstanceBehaviour::IS_CHORD) {
     /* We special-case the global chord instance behaviour so
        it can update the current chord as fast as possible
-       (without having to sort events in the buffer first),
-       and so we can lock just once for the whole midi buffer: */
-    auto* chd = GlobalChordStore::getInstance();
-    ScopedWriteLock l(chd->globalStoreLock);
+       (without having to sort events in the buffer first).
+       Pattern instances don't see the changes until updateChordStore publishes
+       them in the timeline. The host compensates our latency by giving us our
+       events that many samples before the pattern instances get theirs, so the
+       changes are stamped with the position the pattern instances will see: */
+    auto* chd = getGlobalChordStore();
+    const GlobalChordStore::ScopedTryWriteLock l(*chd);
+    curBlockStats.chordStoreWaitMicros =
+      (float)(Time::highResolutionTicksToSeconds(l.getWaitTicks()) * 1e6);
+    // The audio thread doesn't wait for another writer (which may be a process
+    // that died holding the lock). The chord notes are then kept for the next
+    // block, and the pattern instances get the chord changes a block late
+    if (!l.isLocked()) {
+      for (auto msgMD : midibuf) {
+        if (msgMD.numBytes != 3)
+          continue;
+        const uint8* data = msgMD.data;
+        uint8 type = data[0] & 0xf0;
+        auto& pending = mPendingChordNotes[data[1] & 0x7f];
+        if (type == 0x90 && data[2] != 0) { // NOTE ON
+          pending.offset++;
+          pending.floor++;
+        }
+        else if (type == 0x80 || type == 0x90) { // NOTE OFF
+          pending.offset--;
+          pending.floor = jmax(pending.floor - 1, 0);
+        }
+        else
+          continue;
+        mHasPendingChordNotes = true;
+      }
+      curBlockStats.numChordPublishesSkipped = 1;
+      return;
+    }
+    if (mHasPendingChordNotes) {
+      for (NoteNumber nn = 0; nn < NumMidiNotes; nn++) {
+        auto& pending = mPendingChordNotes[(size_t)nn];
+        for (int i = pending.offset; i < pending.floor; i++)
+          chd->rmChordNote(nn);
+        for (int i = 0; i < pending.floor; i++)
+          chd->addChordNote(nn);
+        pending = {};
+      }
+      mHasPendingChordNotes = false;
+    }
+    int latency = getLatencySamples();
+    int groupPos = 0;
     for (auto msgMD : midibuf) {
-      auto msg = msgMD.getMessage();
-      if (msg.isNoteOn())
-        chd->addChordNote(msg.getNoteNumber());
-      if (msg.isNoteOff())
-        chd->rmChordNote(msg.getNoteNumber());
+      // In sample-accurate mode, each group of events sharing the same timestamp
+      // is published on its own
+      if (sampleAccurate && msgMD.samplePosition != groupPos) {
+        updateChordStore(chd, getTimelinePosition(groupPos + latency));
+        groupPos = msgMD.samplePosition;
+      }
+      if (msgMD.numBytes != 3)
+        continue;
+      const uint8* data = msgMD.data;
+      uint8 type = data[0] & 0xf0;
+      if (type == 0x90 && data[2] != 0) // NOTE ON
+        chd->addChordNote(data[1]);
+      else if (type == 0x80 || type == 0x90) // NOTE OFF
+        chd->rmChordNote(data[1]);
     }
-    updateChordStore(chd);
+    updateChordStore(chd, getTimelinePosition(groupPos + latency));
     return;
   }
 
-  Array<NoteNumber> chordNoteOns, chordNoteOffs;
-  Array<MidiMessage> ptrnNoteOns, ptrnNoteOffs, otherMsgs;
+  ChordStore* chd = getChordStore(behaviour);
 
-  for (auto msgMD : midibuf) {
-    auto msg = msgMD.getMessage();
-    if (msg.isNoteOn()) {
-      if (behaviour == msg.getChannel())
-        chordNoteOns.add(msg.getNoteNumber());
-      else
-        ptrnNoteOns.add(msg);
-    }
-    else if (msg.isNoteOff()) {
-      if (behaviour == msg.getChannel())
-        chordNoteOffs.add(msg.getNoteNumber());
-      else
-        ptrnNoteOffs.add(msg);
+  mOutBuffer.clear();
+  MidiBufferRewriter out(midibuf, mOutBuffer);
+
+  auto it = midibuf.cbegin();
+  while (it != midibuf.cend()) {
+    /* In per-block mode, the whole buffer is one single group of events, all
+       sent at the beginning of the buffer. In sample-accurate mode, each group
+       contains the events sharing the same timestamp, so that chord updates and
+       pattern mappings happen at the exact position of the events: */
+    int groupPos = (*it).samplePosition;
+    mChordNoteOns.clearQuick();
+    mChordNoteOffs.clearQuick();
+    mPtrnNoteOns.clearQuick();
+    mPtrnNoteOffs.clearQuick();
+    mPtrnLateNoteOffs.clearQuick();
+    mOtherMsgs.clearQuick();
+
+    for (; it != midibuf.cend() &&
+      (!sampleAccurate || (*it).samplePosition == groupPos); ++it) {
+      auto msgMD = *it;
+      // Note and controller messages are 3 bytes long. The other ones (like
+      // sysex) are passed through as they are. The messages are read from the
+      // raw bytes, without being copied into MidiMessages:
+      if (msgMD.numBytes != 3) {
+        mOtherMsgs.add(msgMD);
+        continue;
+      }
+      const uint8* data = msgMD.data;
+      uint8 type = data[0] & 0xf0;
+      int chan = (data[0] & 0x0f) + 1;
+      if (type == 0x90 && data[2] != 0) { // NOTE ON
+        if (behaviour == chan)
+          mChordNoteOns.add(data[1]);
+        else {
+          // The late note OFFs are sent after all the note ONs of their group,
+          // so a note turned on again after one of them has to be turned on in
+          // a group of its own, or it would end up released:
+          auto noteOnChan = (size_t)Mapping::getNoteOnChan(data);
+          if (mLateNoteOffsInGroup[noteOnChan])
+            break;
+          mPtrnNoteOns.add(data, out.getSource(msgMD));
+          mNoteOnsInGroup.set(noteOnChan);
+        }
+      }
+      else if (type == 0x80 || type == 0x90) { // NOTE OFF, or NOTE ON with 0 velocity
+        if (behaviour == chan)
+          mChordNoteOffs.add(data[1]);
+        // Releasing the note before it is turned on would leave it stuck:
+        else if (mNoteOnsInGroup[(size_t)Mapping::getNoteOnChan(data)]) {
+          mPtrnLateNoteOffs.add(data, out.getSource(msgMD));
+          mLateNoteOffsInGroup.set((size_t)Mapping::getNoteOnChan(data));
+        }
+        else
+          mPtrnNoteOffs.add(data, out.getSource(msgMD));
+      }
+      else {
+        // The receiver of an all notes off or all sound off message will stop
+        // all the notes of the channel, so we can forget how they were mapped.
+        // As the other messages are sent before the notes of their group, the
+        // notes turned on before it have to be sent in a group of their own:
+        if (type == 0xb0 && (data[1] == 123 || data[1] == 120)) {
+          if (!mPtrnNoteOns.isEmpty())
+            break;
+          mPatternMapper.clearChannel(chan);
+        }
+        mOtherMsgs.add(msgMD);
+      }
     }
-    else
-      otherMsgs.add(msg);
-  }
-
-  midibuf.clear();
 
-  for (auto& msg : otherMsgs)
-    midibuf.addEvent(msg, 0);
-
-  ChordStore* chd = getChordStore(behaviour);
+    // Where the mappings of the pattern notes are kept. The notes turned on in
+    // this group are then forgotten for the next one
+    mPtrnNoteOns.computeNoteOnChans();
+    mPtrnNoteOffs.computeNoteOnChans();
+    mPtrnLateNoteOffs.computeNoteOnChans();
+    for (NoteOnChan noteOnChan : mPtrnNoteOns.noteOnChans)
+      mNoteOnsInGroup.reset((size_t)noteOnChan);
+    for (NoteOnChan noteOnChan : mPtrnLateNoteOffs.noteOnChans)
+      mLateNoteOffsInGroup.reset((size_t)noteOnChan);
+
+    int outPos = sampleAccurate ? groupPos : 0;
+
+    for (auto& msgMD : mOtherMsgs)
+      out.add(out.getSource(msgMD), msgMD.data, msgMD.numBytes, outPos);
+
+    if (behaviour != InstanceBehaviour::IS_PATTERN) {
+      for (int n : mChordNoteOns)
+        chd->addChordNote(n);
+      for (int n : mChordNoteOffs)
+        chd->rmChordNote(n);
+      updateChordStore(chd, getTimelinePosition(outPos));
+    }
 
-  if (behaviour != InstanceBehaviour::IS_PATTERN) {
-    for (int n : chordNoteOns)
-      chd->addChordNote(n);
-    for (int n : chordNoteOffs)
-      chd->rmChordNote(n);
-    updateChordStore(chd);
+    processPatternNotes(chd, out, outPos);
   }
 
-  processPatternNotes(chd, ptrnNoteOns, ptrnNoteOffs, midibuf);
+  // If the events could not all be rewritten in place, the buffer we filled
+  // becomes the output, and the input buffer's storage will be reused for the
+  // next call:
+  out.finish();
 }
 
-void Arp::processPatternNotes(ChordStore* chd, Array<MidiMessage>& noteOns, Array<MidiMessage>& noteOffs, MidiBuffer& midibuf) {
-  auto mappingMode = (PatternNotesMapping::Enum)patternNotesMapping->getIndex();
-  auto wrapMode = (PatternNotesWraparound::Enum)patternNotesWraparound->getIndex();
-  auto unmappedBeh = (UnmappedNotesBehaviour::Enum)unmappedNotesBehaviour->getIndex();
-  auto referenceNote = firstDegreeCode->getIndex();
+void Arp::processPatternNotes(ChordStore* chd, MidiBufferRewriter& out, int samplePos) {
+  // In per-block mode, the pattern instances use the latest chord, like older
+  // versions did: the chord instance runs ahead by its latency, so the chord
+  // changes the whole block has to follow are already published
+  chd->getChordAt(mSettings.sampleAccurate ? getTimelinePosition(samplePos) : UnknownPosition, mCurChord);
 
-  Chord curChord;
-  bool shouldProcess, shouldSilence;
-  chd->getCurrentChord(curChord, shouldProcess, shouldSilence);
-
-  if (shouldSilence)
-    noteOns.clear();
-
-  // Process and add processable messages:
+  if (mCurChord.shouldSilence) {
+    curBlockStats.numNotesSilenced += mPtrnNoteOns.size();
+    mPtrnNoteOns.clearQuick();
+  }
 
-  for (auto& msg : noteOffs) { // Note OFFs first
-    Array<NoteNumber>& thisNoteMappings =
-      mCurMappings.getReference(Mapping::getNoteOnChan(msg));
-    for (NoteNumber nn : thisNoteMappings) {
-      MidiMessage newMsg(msg);
-      newMsg.setNoteNumber(nn);
-      midibuf.addEvent(newMsg, 0);
-    }
-    thisNoteMappings.clear();
+  if (!mPtrnNoteOns.isEmpty())
+    mPatternMapper.setChord(mSettings.mapping, mCurChord);
+
+  // Process and add processable messages. The events are written in one pass
+  // over each array, as they must come out in order: a note ON may replace the
+  // mappings of a previous note ON of the same group
+
+  releasePatternNotes(mPtrnNoteOffs, out, samplePos); // Note OFFs first
+
+  int numMapped = 0;
+  for (int i = 0; i < mPtrnNoteOns.size(); i++) { // Then note ONs
+    uint8 status = mPtrnNoteOns.statuses[i];
+    uint8 noteOffStatus = 0x80 | (status & 0x0f);
+    int source = mPtrnNoteOns.sources[i];
+    uint8 velocity = mPtrnNoteOns.velocities[i];
+    bool isMapped = mPatternMapper.mapNoteOn(mPtrnNoteOns.noteOnChans[i], mPtrnNoteOns.notes[i],
+      [&](NoteNumber nn) { out.addNoteEvent(-1, noteOffStatus, nn, 0, samplePos); },
+      [&](NoteNumber nn) { out.addNoteEvent(source, status, nn, velocity, samplePos); });
+    if (isMapped)
+      numMapped++;
   }
+  curBlockStats.numNotesMapped += numMapped;
+  curBlockStats.numNotesSilenced += mPtrnNoteOns.size() - numMapped;
 
-  for (auto& msg : noteOns) { // Then note ONs
-    NoteNumber noteCodeIn = msg.getNoteNumber();
-    // This should create a default (empty) array if the note has not
-    // been mapped yet:
-    Array<NoteNumber>& thisNoteMappings =
-      mCurMappings.getReference(Mapping::getNoteOnChan(msg));
-    // If we already have mappings for this note, it means we received 2+ NOTE ONs
-    // in a row for it and no NOTE OFF, so first we off those mappings:
-    for (NoteNumber nn : thisNoteMappings)
-      midibuf.addEvent(MidiMessage::noteOff(msg.getChannel(), nn), 0);
-    thisNoteMappings.clear();
-
-    if (shouldProcess) // The ChordStore tells us to process
-      Mapping::mapPatternNote(referenceNote,
-        mappingMode,
-        wrapMode,
-        unmappedBeh,
-        curChord,
-        noteCodeIn,
-        thisNoteMappings);
-    else // We map the note to itself
-      thisNoteMappings.add(noteCodeIn);
-
-    // We send NOTE ONs for all newly mapped notes:
-    for (NoteNumber nn : thisNoteMappings) {
-      MidiMessage newMsg(msg);
-      newMsg.setNoteNumber(nn);
-      midibuf.addEvent(newMsg, 0);
-    }
+  releasePatternNotes(mPtrnLateNoteOffs, out, samplePos);
+}
+
+void Arp::releasePatternNotes(NoteEvents& noteOffs, MidiBufferRewriter& out, int samplePos) {
+  for (int i = 0; i < noteOffs.size(); i++) {
+    int source = noteOffs.sources[i];
+    uint8 status = noteOffs.statuses[i];
+    uint8 velocity = noteOffs.velocities[i];
+    mPatternMapper.mapNoteOff(noteOffs.noteOnChans[i],
+      [&](NoteNumber nn) { out.addNoteEvent(source, status, nn, velocity, samplePos); });
   }
 }
@@ -11,37 +11,350 @@
 #pragma once
 
 #include <JuceHeader.h>
+#include <array>
+#include <bitset>
 #include "PluginProcessor.h"
 #include "ChordStore.h"
+#include "Core/PatternMapper.h"
 
 using namespace juce;
 
-using NoteOnChan = int;
+// The values of all the parameters runArp needs, as plain data. Reading a
+// parameter means a virtual call and a float to index conversion, so they are
+// only read again when one of them changed
+struct ArpSettings {
+  InstanceBehaviour::Enum behaviour = InstanceBehaviour::BYPASS;
+  WhenNoChordNote::Enum whenNoChordNote = WhenNoChordNote::LATCH_LAST_CHORD;
+  WhenSingleChordNote::Enum whenSingleChordNote = WhenSingleChordNote::TRANSPOSE_LAST_CHORD;
+  MappingSettings mapping;
+  bool sampleAccurate = true;
+  int chordBus = 0;
+  ChordBusScope::Enum chordBusScope = ChordBusScope::THIS_PROCESS;
+};
+
+// The pattern note ONs or OFFs of a group of events, gathered field by field
+// from the raw bytes of the MidiBuffer. They are then mapped with a few
+// passes over these arrays, without any MidiMessage being constructed
+struct NoteEvents {
+  // Status bytes (they contain the channel), note numbers and velocities
+  Array<uint8> statuses, notes, velocities;
+  // Where each event is in the buffer being processed (see
+  // MidiBufferRewriter::getSource)
+  Array<int> sources;
+  // Where the mappings of each note are kept in Mappings. Computed all at once
+  // by computeNoteOnChans
+  Array<NoteOnChan> noteOnChans;
+
+  int size() const {
+    return notes.size();
+  }
+
+  bool isEmpty() const {
+    return notes.isEmpty();
+  }
+
+  // data points to a 3-byte note message
+  void add(const uint8* data, int source) {
+    statuses.add(data[0]);
+    notes.add(data[1]);
+    velocities.add(data[2]);
+    sources.add(source);
+  }
+
+  void clearQuick() {
+    statuses.clearQuick();
+    notes.clearQuick();
+    velocities.clearQuick();
+    sources.clearQuick();
+    noteOnChans.clearQuick();
+  }
+
+  void ensureStorageAllocated(int capacity) {
+    statuses.ensureStorageAllocated(capacity);
+    notes.ensureStorageAllocated(capacity);
+    velocities.ensureStorageAllocated(capacity);
+    sources.ensureStorageAllocated(capacity);
+    noteOnChans.ensureStorageAllocated(capacity);
+  }
+
+  void computeNoteOnChans();
+};
+
+/* Appends events at the end of a MidiBuffer. MidiBuffer::addEvent looks for
+   where to insert each event from the start of the buffer, which makes filling
+   a buffer quadratic in its number of events, whereas we always produce them
+   in time order.
+
+   This writes the raw data of the buffer, each event being stored as its
+   sample position (int32), its size (uint16) and its bytes, as MidiBuffer
+   does since JUCE 6. */
+class MidiBufferAppender {
+private:
+  Array<uint8>& mData;
+
+public:
+  explicit MidiBufferAppender(MidiBuffer& buffer) : mData(buffer.data) {
+  }
+
+  // samplePos must not be before the position of the last event of the buffer
+  void add(const uint8* bytes, int numBytes, int samplePos) {
+    jassert(numBytes > 0 && numBytes <= std::numeric_limits<uint16>::max());
+    int offset = mData.size();
+    mData.resize(offset + HeaderSize + numBytes);
+    auto* d = mData.begin() + offset;
+    writeUnaligned<int32>(d, samplePos);
+    writeUnaligned<uint16>(d + sizeof(int32), (uint16)numBytes);
+    memcpy(d + HeaderSize, bytes, (size_t)numBytes);
+  }
+
+  void addNoteEvent(uint8 status, NoteNumber nn, uint8 velocity, int samplePos) {
+    const uint8 bytes[3] = { status, (uint8)nn, velocity };
+    add(bytes, 3, samplePos);
+  }
+
+  // The size of the sample position and size of each event
+  static const int HeaderSize = sizeof(int32) + sizeof(uint16);
+};
+
+/* Writes the events runArp outputs for a buffer it processes. Most of the
+   time, each input event gives exactly one output event of the same size
+   (e.g. a pattern note mapped to one chord note), in the same order. The
+   output events are then written over the input ones, directly in the raw
+   data of the input buffer, which becomes the output without anything being
+   copied.
+
+   As soon as that is not the case (a note mapped to several notes or
+   silenced, events reordered...), the events rewritten so far are moved to
+   the output buffer, and all the following ones are appended to it. Then
+   finish() swaps the two buffers. */
+class MidiBufferRewriter {
+private:
+  MidiBuffer& mInput;
+  MidiBuffer& mOutput;
+  MidiBufferAppender mAppender;
+  // Where the next input event to be rewritten starts in the input data
+  int mCursor = 0;
+  bool mInPlace = true;
+
+  // The events from the cursor on have no output event where they are
+  bool canRewrite(int source, int numBytes) const {
+    return mInPlace && source == mCursor &&
+      readUnaligned<uint16>(mInput.data.begin() + source + sizeof(int32)) == numBytes;
+  }
+
+  void stopRewriting() {
+    mOutput.clear();
+    mOutput.data.addArray(mInput.data.begin(), mCursor);
+    mInPlace = false;
+  }
+
+public:
+  // output must be empty
+  MidiBufferRewriter(MidiBuffer& input, MidiBuffer& output)
+    : mInput(input), mOutput(output), mAppender(output) {
+  }
+
+  // Identifies an input event, for it to possibly be rewritten where it is
+  int getSource(const MidiMessageMetadata& msgMD) const {
+    return (int)(msgMD.data - mInput.data.begin()) - MidiBufferAppender::HeaderSize;
+  }
+
+  // Adds an event produced from the input event source (or from no input
+  // event if source is -1). The input event has to have been read already
+  void add(int source, const uint8* bytes, int numBytes, int samplePos) {
+    if (canRewrite(source, numBytes)) {
+      auto* d = mInput.data.begin() + mCursor;
+      writeUnaligned<int32>(d, samplePos);
+      memmove(d + MidiBufferAppender::HeaderSize, bytes, (size_t)numBytes);
+      mCursor += MidiBufferAppender::HeaderSize + numBytes;
+      return;
+    }
+    if (mInPlace)
+      stopRewriting();
+    mAppender.add(bytes, numBytes, samplePos);
+  }
+
+  void addNoteEvent(int source, uint8 status, NoteNumber nn, uint8 velocity, int samplePos) {
+    const uint8 bytes[3] = { status, (uint8)nn, velocity };
+    add(source, bytes, 3, samplePos);
+  }
+
+  // Makes the input buffer contain the output events
+  void finish() {
+    // If the last input events gave nothing, they are not simply truncated
+    // from the input data, as juce::Array would then shrink its storage
+    if (mInPlace && mCursor < mInput.data.size())
+      stopRewriting();
+    if (!mInPlace)
+      mInput.swapWith(mOutput);
+  }
+
+  JUCE_DECLARE_NON_COPYABLE(MidiBufferRewriter)
+};
+
+// Minimum number of events the per-block scratch storage of Arp can hold
+// without having to grow
+const int MinScratchCapacity = 256;
+// Room reserved in the output MidiBuffer for each of these events (a note
+// event takes 9 bytes in a MidiBuffer, and pattern notes may be mapped to
+// several notes)
+const int OutputBytesPerEvent = 32;
+
+
+class Arp;
+
+// A single timer, shared by all the instances of the process, that applies
+// on the message thread the parameter changes they flagged, and retries
+// opening the shared chord buses they need. It only runs while there are
+// instances (see SharedResourcePointer)
+class ArpMessageThreadUpdater : private Timer {
+private:
+  CriticalSection mLock;
+  Array<Arp*> mArps;
+
+  void timerCallback() override;
+
+  JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ArpMessageThreadUpdater);
+
+public:
+  ArpMessageThreadUpdater() {
+    startTimerHz(10);
+  }
+
+  ~ArpMessageThreadUpdater() override {
+    stopTimer();
+  }
 
-using Mappings = HashMap< NoteOnChan, Array<NoteNumber> >;
+  void add(Arp* arp) {
+    const ScopedLock lock(mLock);
+    mArps.add(arp);
+  }
 
-class Arp : public ArplignerAudioProcessor {
+  void remove(Arp* arp) {
+    const ScopedLock lock(mLock);
+    mArps.removeFirstMatchingValue(arp);
+  }
+};
+
+
+class Arp : public ArplignerAudioProcessor,
+  private AudioProcessorParameter::Listener {
 private:
   ChordStore mLocalChordStore;
 
-  // On each pattern chan, to which note has been mapped each incoming
-  // NoteNumber, so we can send the correct NOTE OFFs afterwards
-  Mappings mCurMappings;
+  // Set by prepareToPlay. The latency can't be computed before that. It is
+  // also read by the message thread, when a parameter changes
+  std::atomic<double> mSampleRate{ 0 };
+
+  ArpSettings mSettings;
+  // Set whenever a parameter changes, from any thread, so that mSettings is
+  // read again before the next block
+  std::atomic<bool> mSettingsChanged{ true };
+  // Set whenever a parameter the latency depends on changes, from any thread.
+  // The shared updater checks it regularly
+  std::atomic<bool> mLatencyDirty{ false };
+  SharedResourcePointer<ArpMessageThreadUpdater> mUpdater;
+
+  void readSettings();
 
-  void updateChordStore(ChordStore* chordStore) {
+  PatternMapper mPatternMapper;
+
+  // Scratch storage used by runArp. It is preallocated in prepareToPlay and
+  // only cleared (not freed) between event groups, so that the audio thread
+  // does not allocate in the steady state
+  Array<NoteNumber> mChordNoteOns, mChordNoteOffs;
+  // Note OFFs are processed before the note ONs of their group, except the
+  // late ones, which release a note turned on earlier in the same group
+  NoteEvents mPtrnNoteOns, mPtrnNoteOffs, mPtrnLateNoteOffs;
+  // The notes turned on so far in the group being read, by NoteOnChan
+  std::bitset<NumMidiChannels * NumMidiNotes> mNoteOnsInGroup;
+  // The notes released late so far in the group being read
+  std::bitset<NumMidiChannels * NumMidiNotes> mLateNoteOffsInGroup;
+  // These point to data of the buffer being processed, and are therefore only
+  // valid during the runArp call that filled them
+  Array<MidiMessageMetadata> mOtherMsgs;
+  MidiBuffer mOutBuffer;
+  ChordSnapshot mCurChord;
+
+  // The chord notes received by the global chord instance during the blocks
+  // where another writer held the chord bus. They are added to the chord store
+  // at the beginning of the next block that gets it. Whatever their number,
+  // the NOTE ONs and OFFs of a note take its counter c to max(c + offset, floor)
+  // (as the counters don't go below 0), which is what releasing the note
+  // floor - offset times and then adding it floor times does
+  struct PendingChordNote {
+    int offset = 0;
+    int floor = 0;
+  };
+  std::array<PendingChordNote, NumMidiNotes> mPendingChordNotes;
+  bool mHasPendingChordNotes = false;
+
+  // Where the block being processed starts on the host's timeline, or
+  // UnknownPosition if the host's transport is not playing
+  TimelinePosition mBlockPosition = UnknownPosition;
+
+  TimelinePosition getTimelinePosition(int samplePos) const {
+    return mBlockPosition == UnknownPosition ? UnknownPosition : mBlockPosition + samplePos;
+  }
+
+  void updateBlockPosition();
+
+  void updateChordStore(ChordStore* chordStore, TimelinePosition position) {
     chordStore->updateCurrentChord
-    ((WhenNoChordNote::Enum)whenNoChordNote->getIndex(),
-      (WhenSingleChordNote::Enum)whenSingleChordNote->getIndex());
+    (mSettings.whenNoChordNote,
+      mSettings.whenSingleChordNote,
+      position);
+  }
+
+  GlobalChordStore* getGlobalChordStore() {
+    return &ChordBuses::getInstance()->getBus(mSettings.chordBus, mSettings.chordBusScope);
   }
 
   ChordStore* getChordStore(InstanceBehaviour::Enum beh) {
     if (beh >= InstanceBehaviour::IS_CHORD)
-      return GlobalChordStore::getInstance();
+      return getGlobalChordStore();
     else
       return &mLocalChordStore;
   }
 
-  void processPatternNotes(ChordStore* chd, Array<MidiMessage>&, Array<MidiMessage>&, MidiBuffer&);
+  void processPatternNotes(ChordStore* chd, MidiBufferRewriter&, int);
+  void releasePatternNotes(NoteEvents& noteOffs, MidiBufferRewriter&, int);
+
+  // Reports the latency the global chord instance needs to get its events
+  // numMillisecsOfLatency ahead of the pattern instances (no latency for the
+  // other instances)
+  void updateLatency();
+
+  // Tried again each time, if the shared buses couldn't be opened before
+  // (another process may still be initialising them)
+  void openSharedChordBusesIfNeeded() {
+    if (chordBusScope->getIndex() == ChordBusScope::ALL_PROCESSES)
+      ChordBuses::getInstance()->openSharedBuses();
+  }
+
+  // The latency depends on parameters that can be changed from any thread,
+  // but is only updated from the message thread.
+  // Hosts may automate them from the audio thread, so this only sets a flag
+  // (triggerAsyncUpdate would take the lock of the message queue)
+  void parameterValueChanged(int parameterIndex, float) override {
+    mSettingsChanged.store(true, std::memory_order_release);
+    if (parameterIndex == instanceBehaviour->getParameterIndex() ||
+      parameterIndex == numMillisecsOfLatency->getParameterIndex())
+      mLatencyDirty.store(true, std::memory_order_release);
+  }
+
+  void parameterGestureChanged(int, bool) override {
+  }
+
+  // Called by mUpdater, on the message thread
+  void handleParameterChanges() {
+    if (mLatencyDirty.load(std::memory_order_relaxed) &&
+      mLatencyDirty.exchange(false, std::memory_order_acquire))
+      updateLatency();
+    // Also covers the scope being switched to ALL_PROCESSES
+    openSharedChordBusesIfNeeded();
+  }
+  friend class ArpMessageThreadUpdater;
 
   //void finalizeMappings(MidiBuffer&);
 
@@ -49,10 +362,20 @@ private:
 
 public:
   Arp() : ArplignerAudioProcessor() {
-    mCurMappings.clear();
+    for (auto* param : getParameters())
+      param->addListener(this);
+    mUpdater->add(this);
+  }
+
+  ~Arp() override {
+    for (auto* param : getParameters())
+      param->removeListener(this);
+    mUpdater->remove(this);
   }
 
   void prepareToPlay(double, int) override;
 
   void runArp(MidiBuffer&) override;
+
+  String getStatusText() const override;
 };
@@ -0,0 +1,121 @@
+/*
+  ==============================================================================
+
+    BlockStats.cpp
+
+  ==============================================================================
+*/
+
+#include "BlockStats.h"
+
+String BlockStatsRecorder::getFieldName(Field field) {
+  switch (field) {
+  case PROCESSING_MICROS: return "Processing time (us)";
+  case EVENTS_IN: return "Events in";
+  case EVENTS_OUT: return "Events out";
+  case NOTES_MAPPED: return "Notes mapped";
+  case NOTES_SILENCED: return "Notes silenced";
+  case CHORD_STORE_WAIT_MICROS: return "Chord store wait (us)";
+  case CHORD_PUBLISHES_SKIPPED: return "Publishes skipped";
+  default: return {};
+  }
+}
+
+double BlockStatsRecorder::getFieldValue(const BlockStats& stats, Field field) {
+  switch (field) {
+  case PROCESSING_MICROS: return stats.processingMicros;
+  case EVENTS_IN: return stats.numEventsIn;
+  case EVENTS_OUT: return stats.numEventsOut;
+  case NOTES_MAPPED: return stats.numNotesMapped;
+  case NOTES_SILENCED: return stats.numNotesSilenced;
+  case CHORD_STORE_WAIT_MICROS: return stats.chordStoreWaitMicros;
+  case CHORD_PUBLISHES_SKIPPED: return stats.numChordPublishesSkipped;
+  default: return 0;
+  }
+}
+
+BlockStatsRecorder::BlockStatsRecorder() : mHistory(HistorySize) {
+}
+
+BlockStatsRecorder::~BlockStatsRecorder() {
+  stopTimer();
+}
+
+void BlockStatsRecorder::push(const BlockStats& stats) {
+  const auto scope = mFifo.write(1);
+  if (scope.blockSize1 + scope.blockSize2 == 0) {
+    mNumDropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  scope.forEach([&](int i) { mFifoData[i] = stats; });
+}
+
+void BlockStatsRecorder::setEnabled(bool shouldBeEnabled) {
+  mEnabled.store(shouldBeEnabled, std::memory_order_relaxed);
+  if (shouldBeEnabled)
+    startTimerHz(10);
+  else {
+    stopTimer();
+    collect();
+  }
+}
+
+void BlockStatsRecorder::collect() {
+  const auto scope = mFifo.read(mFifo.getNumReady());
+  scope.forEach([&](int i) {
+    mHistory[(size_t)mHistoryPos] = mFifoData[i];
+    mHistoryPos = (mHistoryPos + 1) % HistorySize;
+    mHistoryCount = jmin(mHistoryCount + 1, HistorySize);
+    mNumRecorded++;
+  });
+}
+
+void BlockStatsRecorder::clear() {
+  collect();
+  mHistoryPos = 0;
+  mHistoryCount = 0;
+  mNumRecorded = 0;
+  mNumDropped.store(0, std::memory_order_relaxed);
+}
+
+StatSummary BlockStatsRecorder::getSummary(Field field) const {
+  StatSummary res;
+  if (mHistoryCount == 0)
+    return res;
+
+  std::vector<double> values;
+  values.reserve((size_t)mHistoryCount);
+  for (int i = 0; i < mHistoryCount; i++)
+    values.push_back(getFieldValue(mHistory[(size_t)i], field));
+  std::sort(values.begin(), values.end());
+
+  res.min = values.front();
+  res.max = values.back();
+  res.mean = std::accumulate(values.begin(), values.end(), 0.0) / (double)values.size();
+  res.p99 = values[(size_t)std::round(0.99 * (double)(values.size() - 1))];
+  return res;
+}
+
+bool BlockStatsRecorder::dumpToFile(const File& file) const {
+  String csv;
+  csv << "# " << mNumRecorded << " blocks recorded, " << getNumBlocksDropped() << " dropped, last "
+      << mHistoryCount << " below\n";
+  csv << "# statistic,min,mean,p99,max\n";
+  for (int f = 0; f < NumFields; f++) {
+    auto summary = getSummary((Field)f);
+    csv << "# " << getFieldName((Field)f) << "," << summary.min << "," << summary.mean << ","
+        << summary.p99 << "," << summary.max << "\n";
+  }
+
+  for (int f = 0; f < NumFields; f++)
+    csv << getFieldName((Field)f) << (f == NumFields - 1 ? "\n" : ",");
+  // From the oldest block to the newest one:
+  int first = (mHistoryCount == HistorySize) ? mHistoryPos : 0;
+  for (int i = 0; i < mHistoryCount; i++) {
+    auto& stats = mHistory[(size_t)((first + i) % HistorySize)];
+    for (int f = 0; f < NumFields; f++)
+      csv << getFieldValue(stats, (Field)f) << (f == NumFields - 1 ? "\n" : ",");
+  }
+
+  return file.replaceWithText(csv);
+}
@@ -0,0 +1,122 @@
+/*
+  ==============================================================================
+
+    BlockStats.h
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+using namespace juce;
+
+// What happened during one processBlock call
+struct BlockStats {
+  float processingMicros = 0;
+  int numEventsIn = 0;
+  int numEventsOut = 0;
+  // Pattern NOTE ONs that were turned into at least one note, and those that
+  // ended up sending no note at all
+  int numNotesMapped = 0;
+  int numNotesSilenced = 0;
+  // Time spent waiting for another instance to be done with the global chord
+  // store. Only writers may have to wait, pattern instances never do
+  float chordStoreWaitMicros = 0;
+  // 1 if the chord instance couldn't get the global chord store without
+  // waiting, so its chord changes are only published with the next block
+  int numChordPublishesSkipped = 0;
+};
+
+// Some field of BlockStats, aggregated over the last recorded blocks
+struct StatSummary {
+  double min = 0;
+  double mean = 0;
+  double p99 = 0;
+  double max = 0;
+};
+
+
+// Collects the BlockStats of the audio thread without ever blocking it. The
+// audio thread pushes them into a lock-free FIFO, and a timer on the message
+// thread moves them into a history of the last HistorySize blocks, over which
+// summaries are computed
+class BlockStatsRecorder : private Timer {
+public:
+  static const int HistorySize = 4096;
+
+  enum Field {
+    PROCESSING_MICROS = 0,
+    EVENTS_IN,
+    EVENTS_OUT,
+    NOTES_MAPPED,
+    NOTES_SILENCED,
+    CHORD_STORE_WAIT_MICROS,
+    CHORD_PUBLISHES_SKIPPED,
+    NumFields
+  };
+
+  static String getFieldName(Field);
+  static double getFieldValue(const BlockStats&, Field);
+
+  BlockStatsRecorder();
+  ~BlockStatsRecorder() override;
+
+  // Audio thread. If the message thread lags behind so much that the FIFO is
+  // full, the stats are dropped (and counted as such)
+  void push(const BlockStats&);
+
+  bool isEnabled() const {
+    return mEnabled.load(std::memory_order_relaxed);
+  }
+
+  // All the following are for the message thread only
+
+  void setEnabled(bool);
+
+  // Moves what the audio thread pushed into the history. Called regularly by
+  // the timer while recording
+  void collect();
+
+  // Forgets all the recorded blocks
+  void clear();
+
+  int getNumBlocksInHistory() const {
+    return mHistoryCount;
+  }
+
+  int64 getNumBlocksRecorded() const {
+    return mNumRecorded;
+  }
+
+  int64 getNumBlocksDropped() const {
+    return mNumDropped.load(std::memory_order_relaxed);
+  }
+
+  StatSummary getSummary(Field) const;
+
+  // Writes the summaries and then the stats of each block in the history, as
+  // CSV
+  bool dumpToFile(const File&) const;
+
+private:
+  static const int FifoSize = 1024;
+
+  std::atomic<bool> mEnabled{ false };
+  AbstractFifo mFifo{ FifoSize };
+  BlockStats mFifoData[FifoSize];
+  std::atomic<int64> mNumDropped{ 0 };
+
+  // Circular, the oldest block being at mHistoryPos once the history is full
+  std::vector<BlockStats> mHistory;
+  int mHistoryPos = 0;
+  int mHistoryCount = 0;
+  int64 mNumRecorded = 0;
+
+  void timerCallback() override {
+    collect();
+  }
+
+  JUCE_DECLARE_NON_COPYABLE(BlockStatsRecorder)
+};
@@ -1,73 +1,175 @@
 #include "ChordStore.h"
+#include "SharedChordBuses.h"
 
-void ChordStore::updateCurrentChord(WhenNoChordNote::Enum whenNoChordNoteVal,
-  WhenSingleChordNote::Enum whenSingleChordNoteVal) {
-  if (!mNeedsUpdate)
-    return;
+bool GlobalChordStore::updateCurrentChord(WhenNoChordNote::Enum whenNoChordNoteVal,
+  WhenSingleChordNote::Enum whenSingleChordNoteVal,
+  TimelinePosition position) {
+  bool changed = ChordStore::updateCurrentChord(whenNoChordNoteVal, whenSingleChordNoteVal, position);
+  // Hosts don't send the held notes again when they jump back on their
+  // timeline, so the current chord has to be published at the new position
+  // even if it didn't change. The positions seen while the transport was
+  // stopped are ignored, as it is often moved back while stopped
+  bool jumpedBack = false;
+  if (position != UnknownPosition) {
+    TimelinePosition& lastPosition = mTimeline.lastUpdatePosition;
+    jumpedBack = lastPosition != UnknownPosition && position < lastPosition;
+    lastPosition = position;
+  }
+  if (changed || jumpedBack)
+    publishCurrentChord(position, jumpedBack);
+  return changed;
+}
 
-  mShouldSilence = false;
-  mShouldProcess = true;
+void GlobalChordStore::publishCurrentChord(TimelinePosition position, bool startsTimeline) {
+  // Only writers call this, and they are serialised by mWriterLock
+  uint64 seq = mTimeline.numPublished.load(std::memory_order_relaxed) + 1;
+  ChordTimeline::Entry entry;
+  entry.position = position;
+  entry.snapshot = getCurrentChord();
+  mTimeline.slots[seq % ChordTimeline::NumSlots].write(seq, entry);
+  if (startsTimeline)
+    mTimeline.firstValid.store(seq, std::memory_order_relaxed);
+  mTimeline.numPublished.store(seq, std::memory_order_release);
+}
 
-  Chord newChord;
-  for (Counters::Iterator i(mCounters); i.next();) {
-    newChord.add(i.getKey());
-  }
+void GlobalChordStore::getChordAt(TimelinePosition position, ChordSnapshot& snapshot) {
+  if (position == UnknownPosition)
+    position = std::numeric_limits<int64>::max();
 
-  switch (newChord.size()) {
-  case 0:
-    // No chord notes
-    switch (whenNoChordNoteVal) {
-    case WhenNoChordNote::LATCH_LAST_CHORD:
-      if (mCurrentChord.size() == 0)
-        // No last chord known. We silence
-        mShouldSilence = true;
-      break;
-    case WhenNoChordNote::USE_PATTERN_AS_NOTES:
-      mShouldProcess = false;
-      break;
-    case WhenNoChordNote::SILENCE:
-      mShouldSilence = true;
-      break;
+  for (int attempt = 0; attempt < MaxReadAttempts; attempt++) {
+    uint64 latest = mTimeline.numPublished.load(std::memory_order_acquire);
+    // Older entries may already be overwritten, or may have been invalidated
+    const uint64 numSlots = ChordTimeline::NumSlots;
+    uint64 oldest = jmax(latest > numSlots - 2 ? latest - (numSlots - 2) : (uint64)0,
+      mTimeline.firstValid.load(std::memory_order_relaxed));
+    bool retry = false;
+    // Walks back from the latest entry to the first one at or before position
+    for (uint64 seq = latest;; seq--) {
+      // Fails if the writer is already reusing the slot, for entry
+      // seq + numSlots
+      ChordTimeline::Entry copy;
+      if (!mTimeline.slots[seq % numSlots].read(seq, copy)) {
+        retry = true;
+        break;
+      }
+      if (seq == latest)
+        snapshot = copy.snapshot;
+      if (copy.position != UnknownPosition && copy.position <= position) {
+        snapshot = copy.snapshot;
+        return;
+      }
+      // An entry at UnknownPosition is only in effect until the next one. When
+      // no valid entry is at or before position, the latest one is used
+      if (copy.position == UnknownPosition || seq <= oldest)
+        return;
     }
-    break;
+    if (!retry)
+      return;
+    mNumFailedReadAttempts.fetch_add(1, std::memory_order_relaxed);
+  }
+  mNumStaleReads.fetch_add(1, std::memory_order_relaxed);
+}
 
-  case 1:
-    // Just 1 chord note
-    switch (whenSingleChordNoteVal) {
-    case WhenSingleChordNote::TRANSPOSE_LAST_CHORD:
-      if (mCurrentChord.size() > 0) {
-        int offset = newChord[0] - mCurrentChord[0];
-        newChord.clear();
-        for (NoteNumber nn : mCurrentChord)
-          newChord.add(nn + offset);
-        mCurrentChord = newChord;
-      }
-      else // No last chord known. We silence
-        mShouldSilence = true;
-      break;
-    case WhenSingleChordNote::POWERCHORD:
-      newChord.add(newChord[0] + 7);
-      mCurrentChord = newChord;
-      break;
-    case WhenSingleChordNote::USE_AS_IS:
-      mCurrentChord = newChord;
+int64 GlobalChordStore::enterWriterLock() {
+  if (tryEnterWriterLock())
+    return 0;
+  // Only measured when we actually have to wait, so the uncontended case
+  // stays as cheap as a plain lock
+  auto start = Time::getHighResolutionTicks();
+  // Spins like juce::SpinLock. The lock is only ever held for a few
+  // microseconds, so if it is still held after MaxWriterLockWaitMs, it is
+  // assumed that the process holding it died, and we take it over
+  const int64 maxWaitTicks = Time::secondsToHighResolutionTicks(MaxWriterLockWaitMs / 1000.0);
+  for (int i = 0; !tryEnterWriterLock(); i++) {
+    if (mLockMayBeAbandoned && Time::getHighResolutionTicks() - start > maxWaitTicks)
       break;
-    case WhenSingleChordNote::USE_PATTERN_AS_NOTES:
-      mShouldProcess = false;
-      break;
-    case WhenSingleChordNote::SILENCE:
-      mShouldSilence = true;
-      break;
-    }
-    break;
+    if (i >= 20)
+      Thread::yield();
+  }
+  int64 waitTicks = Time::getHighResolutionTicks() - start;
+  mNumContendedWrites.fetch_add(1, std::memory_order_relaxed);
+  mWriterWaitTicks.fetch_add((uint64)waitTicks, std::memory_order_relaxed);
+  return waitTicks;
+}
 
-  default:
-    // "Normal" case: 2 chords notes or more
-    mCurrentChord = newChord;
-    break;
-  };
+bool GlobalChordStore::tryEnterWriterLockForBlock(int64& waitTicks) {
+  waitTicks = 0;
+  if (tryEnterWriterLock()) {
+    mLockBusySince.store(0, std::memory_order_relaxed);
+    return true;
+  }
+  auto start = Time::getHighResolutionTicks();
+  bool locked = false;
+  for (int i = 0; i < MaxWriterLockSpins && !locked; i++)
+    locked = tryEnterWriterLock();
+  auto now = Time::getHighResolutionTicks();
+  waitTicks = now - start;
+  mNumContendedWrites.fetch_add(1, std::memory_order_relaxed);
+  mWriterWaitTicks.fetch_add((uint64)waitTicks, std::memory_order_relaxed);
+  if (locked) {
+    mLockBusySince.store(0, std::memory_order_relaxed);
+    return true;
+  }
 
-  mNeedsUpdate = false;
+  // The lock is only ever held for a few microseconds, so if it is still held
+  // after MaxWriterLockWaitMs of blocks, it is assumed that the process
+  // holding it died, and we take it over
+  int64 busySince = mLockBusySince.load(std::memory_order_relaxed);
+  if (busySince == 0)
+    mLockBusySince.store(start, std::memory_order_relaxed);
+  else if (mLockMayBeAbandoned &&
+    now - busySince > Time::secondsToHighResolutionTicks(MaxWriterLockWaitMs / 1000.0)) {
+    mTimeline.writerLock.exchange(1, std::memory_order_acquire);
+    mLockBusySince.store(0, std::memory_order_relaxed);
+    return true;
+  }
+  mNumSkippedWrites.fetch_add(1, std::memory_order_relaxed);
+  return false;
+}
+
+ChordStoreContention GlobalChordStore::getContention() const {
+  ChordStoreContention res;
+  res.numContendedWrites = mNumContendedWrites.load(std::memory_order_relaxed);
+  res.writerWaitTicks = mWriterWaitTicks.load(std::memory_order_relaxed);
+  res.numFailedReadAttempts = mNumFailedReadAttempts.load(std::memory_order_relaxed);
+  res.numStaleReads = mNumStaleReads.load(std::memory_order_relaxed);
+  res.numSkippedWrites = mNumSkippedWrites.load(std::memory_order_relaxed);
+  return res;
+}
+
+void GlobalChordStore::resetContention() {
+  mNumContendedWrites.store(0, std::memory_order_relaxed);
+  mWriterWaitTicks.store(0, std::memory_order_relaxed);
+  mNumFailedReadAttempts.store(0, std::memory_order_relaxed);
+  mNumStaleReads.store(0, std::memory_order_relaxed);
+  mNumSkippedWrites.store(0, std::memory_order_relaxed);
+}
+
+ChordBuses::ChordBuses() {
+  for (auto& timeline : mTimelines)
+    mBuses.add(new GlobalChordStore(timeline));
+}
+
+ChordBuses::~ChordBuses() {
+  clearSingletonInstance();
+}
+
+GlobalChordStore& ChordBuses::getBus(int bus, ChordBusScope::Enum scope) {
+  if (scope == ChordBusScope::ALL_PROCESSES)
+    if (auto* shared = mSharedBuses.load(std::memory_order_acquire))
+      return shared->getBus(bus);
+  return getBus(bus);
+}
+
+bool ChordBuses::openSharedBuses() {
+  const ScopedLock lock(mSharedBusesLock);
+  // Tried again each time an instance needs them, as what prevented opening
+  // them (e.g. a segment left by an incompatible version) may have gone
+  if (mSharedBusesOwner == nullptr) {
+    mSharedBusesOwner = SharedChordBuses::open();
+    mSharedBuses.store(mSharedBusesOwner.get(), std::memory_order_release);
+  }
+  return mSharedBusesOwner != nullptr;
 }
 
-JUCE_IMPLEMENT_SINGLETON(GlobalChordStore);
+JUCE_IMPLEMENT_SINGLETON(ChordBuses);
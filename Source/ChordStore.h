@@ -12,80 +12,361 @@
 
 #include <JuceHeader.h>
 #include "PluginProcessor.h"
+#include "Core/ChordTracker.h"
 
 using namespace juce;
 
-using NoteNumber = int;
-using Chord = SortedSet<NoteNumber>;
-using Counters = HashMap<NoteNumber, int>;
+// A position on the host's timeline, in samples
+using TimelinePosition = int64;
 
+// Used when the host does not tell where we are on its timeline (e.g. when
+// its transport is stopped)
+const TimelinePosition UnknownPosition = std::numeric_limits<int64>::min();
 
-// A thread-safe way to keep track of the currently playing chord
+// Keeps track of the currently playing chord
 class ChordStore {
 private:
-  Counters mCounters;
-  Chord mCurrentChord;
-  bool mShouldProcess;
-  bool mShouldSilence;
-  bool mNeedsUpdate;
+  ChordTracker mTracker;
+
+protected:
+  const ChordSnapshot& getCurrentChord() const {
+    return mTracker.getCurrentChord();
+  }
 
 public:
-  ChordStore() : mShouldProcess(true), mShouldSilence(false), mNeedsUpdate(false) {
+  virtual ~ChordStore() {
   }
 
   void addChordNote(NoteNumber nn) {
-    mNeedsUpdate = true;
-    if (!mCounters.contains(nn))
-      mCounters.set(nn, 1);
-    else
-      mCounters.set(nn, mCounters[nn] + 1);
+    mTracker.addChordNote(nn);
   }
 
   void rmChordNote(NoteNumber nn) {
-    mNeedsUpdate = true;
-    if (mCounters.contains(nn))
-      mCounters.set(nn, mCounters[nn] - 1);
-    if (mCounters[nn] <= 0)
-      mCounters.remove(nn);
+    mTracker.rmChordNote(nn);
   }
 
-  void updateCurrentChord(WhenNoChordNote::Enum, WhenSingleChordNote::Enum);
+  // Returns whether the current chord had to be updated. position is where the
+  // chord changes on the host's timeline
+  virtual bool updateCurrentChord(WhenNoChordNote::Enum whenNoChordNoteVal,
+    WhenSingleChordNote::Enum whenSingleChordNoteVal,
+    TimelinePosition) {
+    return mTracker.updateCurrentChord(whenNoChordNoteVal, whenSingleChordNoteVal);
+  }
 
   virtual void flushCurrentChord() {
-    mCounters.clear();
-    mCurrentChord.clear();
-    mShouldProcess = true;
-    mShouldSilence = false;
-    mNeedsUpdate = false;
+    mTracker.flush();
   }
 
-  virtual void getCurrentChord(Chord& chord, bool& shouldProcess, bool& shouldSilence) {
-    chord = mCurrentChord;
-    shouldProcess = mShouldProcess;
-    shouldSilence = mShouldSilence;
+  // The chord in effect at some position of the host's timeline. A local
+  // store is updated along with the pattern notes, so it only knows about the
+  // current chord
+  virtual void getChordAt(TimelinePosition, ChordSnapshot& snapshot) {
+    snapshot = mTracker.getCurrentChord();
   }
 };
 
-// A JUCE singleton ChordStore. Used in a multi-instance configuration
-class GlobalChordStore : public ChordStore {
+// How much the instances sharing the GlobalChordStore got in each other's way
+struct ChordStoreContention {
+  // Number of times a writer had to wait for another one, and total time spent
+  // waiting, in high resolution ticks
+  uint64 numContendedWrites = 0;
+  uint64 writerWaitTicks = 0;
+  // Number of read attempts that failed because the writer was publishing too
+  // fast, and of reads that gave up and kept the previous snapshot
+  uint64 numFailedReadAttempts = 0;
+  uint64 numStaleReads = 0;
+  // Number of blocks a chord instance didn't publish, because another writer
+  // held the bus
+  uint64 numSkippedWrites = 0;
+};
+
+/* The part of a chord bus that pattern instances read, and that global chord
+   instances write.
+
+   Each time the global chord instance updates the current chord, it publishes a
+   copy of it in a timeline: a ring of snapshots, each one stamped with the
+   position where the chord changes on the host's timeline. For each group of
+   pattern events, pattern instances look up the chord in effect at the
+   position of these events (the latest snapshot stamped at or before it), so
+   a chord change that the chord instance has already seen but that is still
+   ahead of the pattern events doesn't affect them too early.
+
+   The host may jump back on its timeline (when the user seeks, or at the end
+   of a loop). The chord instance then publishes its current chord again, at
+   the new position, and the snapshots published before it are no longer
+   looked up: they describe a part of the timeline which is going to be played
+   again, maybe with other chords.
+
+   Readers may copy a slot while the writer is filling it again, so each slot
+   is a seqlock: its entry is only ever accessed word by word with atomics,
+   and its version tells which entry it holds, and whether that entry is
+   being written. A reader that doesn't get the same version before and after
+   copying an entry discards what it copied.
+
+   A ChordTimeline is only made of lock-free atomics, so it can live in memory
+   shared between processes (see SharedChordBuses). Each one starts on its own
+   cache line, so that the instances of different buses never get in each
+   other's way. */
+struct alignas(64) ChordTimeline {
+  // The timeline keeps the last NumSlots - 1 chord changes. That is many more
+  // than can happen while the chord instance runs ahead of the pattern
+  // instances (by its latency, or by the block it is processing)
+  static const int NumSlots = 32;
+
+  struct Entry {
+    // A snapshot published at UnknownPosition is in effect anywhere on the
+    // timeline until the next one is published. The initial empty chord is one
+    // of them
+    TimelinePosition position = UnknownPosition;
+    ChordSnapshot snapshot;
+  };
+
+  static_assert(std::is_trivially_copyable_v<Entry>, "Entries are copied as raw words");
+
+  class Slot {
+  private:
+    static const int NumWords = (int)((sizeof(Entry) + sizeof(uint64) - 1) / sizeof(uint64));
+
+    // 2 * seq once entry seq is in the slot, and odd while it is written
+    std::atomic<uint64> mVersion{ 0 };
+    std::atomic<uint64> mWords[NumWords];
+
+  public:
+    // Holds the initial empty chord, as entry 0
+    Slot() {
+      store(Entry());
+    }
+
+    // Only called by the writer
+    void write(uint64 seq, const Entry& entry) {
+      mVersion.store(2 * seq - 1, std::memory_order_relaxed);
+      // The new words can't become visible before the version says the slot
+      // is being written
+      std::atomic_thread_fence(std::memory_order_release);
+      store(entry);
+      mVersion.store(2 * seq, std::memory_order_release);
+    }
+
+    // Returns false if the slot didn't hold entry seq during the whole copy
+    bool read(uint64 seq, Entry& entry) const {
+      if (mVersion.load(std::memory_order_acquire) != 2 * seq)
+        return false;
+      uint64 words[NumWords];
+      for (int i = 0; i < NumWords; i++)
+        words[i] = mWords[i].load(std::memory_order_relaxed);
+      // The words have to be read before the version is checked again
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (mVersion.load(std::memory_order_relaxed) != 2 * seq)
+        return false;
+      std::memcpy(&entry, words, sizeof(Entry));
+      return true;
+    }
+
+  private:
+    void store(const Entry& entry) {
+      uint64 words[NumWords] = {};
+      std::memcpy(words, &entry, sizeof(Entry));
+      for (int i = 0; i < NumWords; i++)
+        mWords[i].store(words[i], std::memory_order_relaxed);
+    }
+  };
+
+  Slot slots[NumSlots];
+  // Number of snapshots published so far. The latest one is in slot
+  // numPublished % NumSlots
+  std::atomic<uint64> numPublished{ 0 };
+  // The first snapshot that can be looked up. The ones before it were
+  // published before a jump back on the timeline, or before the timeline was
+  // cleared. Always written before numPublished
+  std::atomic<uint64> firstValid{ 0 };
+
+  // The position of the latest update of the chord instance, published or
+  // not, on a playing transport. Only accessed under writerLock
+  TimelinePosition lastUpdatePosition = UnknownPosition;
+
+  // Serialises the instances that modify the bus (there should be only one
+  // global chord instance anyway). Readers never take it. This is not a
+  // juce::SpinLock, which doesn't promise to work across processes
+  std::atomic<uint32> writerLock{ 0 };
+
+  static_assert(std::atomic<uint64>::is_always_lock_free && std::atomic<uint32>::is_always_lock_free,
+    "Atomics shared between processes have to be lock-free");
+};
+
+/* The ChordStore of a chord bus (see ChordBuses). Used in a multi-instance
+   configuration. It publishes to, and reads from, a ChordTimeline it doesn't
+   own.
+
+   Readers never take any lock, so they never have to wait for the chord
+   instance (which may be running at the same time on another thread). A read
+   is only retried if the chord instance published enough new snapshots in the
+   meantime to reuse one of the slots that were being read. */
+class alignas(64) GlobalChordStore : public ChordStore {
+private:
+  // After that many failed attempts, a reader gives up and keeps the snapshot
+  // it previously got
+  static const int MaxReadAttempts = 4;
+  // See tryEnterWriterLockForBlock
+  static const int MaxWriterLockSpins = 20;
+  // See enterWriterLock and tryEnterWriterLockForBlock
+  static const int MaxWriterLockWaitMs = 100;
+
+  ChordTimeline& mTimeline;
+  // Whether the writer lock may be held by a process that died
+  bool mLockMayBeAbandoned;
+  // When tryEnterWriterLockForBlock first failed to get the lock, in high
+  // resolution ticks, or 0 if it got it the last time
+  std::atomic<int64> mLockBusySince{ 0 };
+
+  // Only updated on the slow paths (contended writer lock, retried reads)
+  std::atomic<uint64> mNumContendedWrites{ 0 };
+  std::atomic<uint64> mWriterWaitTicks{ 0 };
+  std::atomic<uint64> mNumFailedReadAttempts{ 0 };
+  std::atomic<uint64> mNumStaleReads{ 0 };
+  std::atomic<uint64> mNumSkippedWrites{ 0 };
+
+  // With startsTimeline, the snapshots published before are invalidated
+  void publishCurrentChord(TimelinePosition position, bool startsTimeline);
+
+  bool tryEnterWriterLock() {
+    uint32 unlocked = 0;
+    return mTimeline.writerLock.compare_exchange_strong(unlocked, 1, std::memory_order_acquire);
+  }
+
+  // Waits for the lock as long as needed, so this is not for the audio thread.
+  // Returns how long we had to wait for it, in high resolution ticks
+  int64 enterWriterLock();
+
+  // Only spins a few times, and never yields. Returns whether the lock was
+  // taken, and sets waitTicks to how long we spun, in high resolution ticks
+  bool tryEnterWriterLockForBlock(int64& waitTicks);
+
+  void exitWriterLock() {
+    mTimeline.writerLock.store(0, std::memory_order_release);
+  }
+
 public:
-  ReadWriteLock globalStoreLock;
+  // To be held while modifying the store, outside of the audio thread
+  class ScopedWriteLock {
+  private:
+    GlobalChordStore& mStore;
+    int64 mWaitTicks;
+
+  public:
+    explicit ScopedWriteLock(GlobalChordStore& store) : mStore(store) {
+      mWaitTicks = mStore.enterWriterLock();
+    }
+
+    ~ScopedWriteLock() {
+      mStore.exitWriterLock();
+    }
+
+    int64 getWaitTicks() const {
+      return mWaitTicks;
+    }
+
+    JUCE_DECLARE_NON_COPYABLE(ScopedWriteLock)
+  };
 
-  ~GlobalChordStore() {
-    clearSingletonInstance();
+  // The same, for the audio thread, which must not wait for another writer: if
+  // the lock is not free, the store must not be modified during this block
+  class ScopedTryWriteLock {
+  private:
+    GlobalChordStore& mStore;
+    int64 mWaitTicks = 0;
+    bool mLocked;
+
+  public:
+    explicit ScopedTryWriteLock(GlobalChordStore& store) : mStore(store) {
+      mLocked = mStore.tryEnterWriterLockForBlock(mWaitTicks);
+    }
+
+    ~ScopedTryWriteLock() {
+      if (mLocked)
+        mStore.exitWriterLock();
+    }
+
+    bool isLocked() const {
+      return mLocked;
+    }
+
+    int64 getWaitTicks() const {
+      return mWaitTicks;
+    }
+
+    JUCE_DECLARE_NON_COPYABLE(ScopedTryWriteLock)
+  };
+
+  GlobalChordStore(ChordTimeline& timeline, bool lockMayBeAbandoned = false)
+    : mTimeline(timeline), mLockMayBeAbandoned(lockMayBeAbandoned) {
   }
 
+  // Also publishes the current chord again if position is before the one of
+  // the previous update, i.e. if the host jumped back on its timeline
+  bool updateCurrentChord(WhenNoChordNote::Enum, WhenSingleChordNote::Enum,
+    TimelinePosition position) override;
+
+  // Also clears the timeline
   void flushCurrentChord() override {
-    const ScopedWriteLock lock(globalStoreLock);
+    const ScopedWriteLock lock(*this);
     ChordStore::flushCurrentChord();
+    publishCurrentChord(UnknownPosition, true);
   }
 
-  void getCurrentChord(Chord& chord, bool& shouldProcess, bool& shouldSilence) override {
-    // This will prevent a Pattern instance to access the current chord if the
-    // Global chord instance is still updating it
-    const ScopedReadLock lock(globalStoreLock);
-    ChordStore::getCurrentChord(chord, shouldProcess, shouldSilence);
+  // Reading at UnknownPosition gives the latest chord, and so does reading
+  // before all the snapshots that are still valid (e.g. when the pattern
+  // instance is the first one to see a jump back on the timeline)
+  void getChordAt(TimelinePosition position, ChordSnapshot& snapshot) override;
+
+  ChordStoreContention getContention() const;
+  void resetContention();
+};
+
+const int NumChordBuses = 16;
+
+class SharedChordBuses;
+
+/* A JUCE singleton holding one GlobalChordStore per chord bus. Each global
+   chord instance publishes on the bus selected by its chordBus parameter, and
+   pattern instances only read the bus selected by theirs, so several chord
+   tracks can drive separate groups of pattern tracks.
+
+   The buses only exist in the current process, unless their scope is
+   ChordBusScope::ALL_PROCESSES, in which case they are shared with the other
+   processes of the machine (see SharedChordBuses). */
+class ChordBuses {
+private:
+  ChordTimeline mTimelines[NumChordBuses];
+  OwnedArray<GlobalChordStore> mBuses;
+
+  // Opened by the first instance that needs them, and then kept until the end
+  CriticalSection mSharedBusesLock;
+  std::unique_ptr<SharedChordBuses> mSharedBusesOwner;
+  std::atomic<SharedChordBuses*> mSharedBuses{ nullptr };
+
+public:
+  ChordBuses();
+  ~ChordBuses();
+
+  // bus is between 0 and NumChordBuses - 1
+  GlobalChordStore& getBus(int bus) {
+    return *mBuses.getUnchecked(bus);
+  }
+
+  // The shared buses are used if they have been opened, otherwise we fall back
+  // on the buses of this process. Real-time safe
+  GlobalChordStore& getBus(int bus, ChordBusScope::Enum scope);
+
+  // Opens the buses shared with the other processes if not done yet. Returns
+  // whether they are available. Not real-time safe. If they couldn't be
+  // opened, the next call tries again
+  bool openSharedBuses();
+
+  // Whether getBus uses the shared buses for ChordBusScope::ALL_PROCESSES.
+  // Real-time safe
+  bool areSharedBusesOpen() const {
+    return mSharedBuses.load(std::memory_order_acquire) != nullptr;
   }
 
-  JUCE_DECLARE_SINGLETON(GlobalChordStore, false);
+  JUCE_DECLARE_SINGLETON(ChordBuses, false);
 };
@@ -0,0 +1,78 @@
+#include "ArplignerC.h"
+#include <new>
+#include "NoteEngine.h"
+
+static_assert((int)ARPLIGNER_WHEN_NO_CHORD_NOTE_LATCH_LAST_CHORD == (int)WhenNoChordNote::LATCH_LAST_CHORD);
+static_assert((int)ARPLIGNER_WHEN_SINGLE_CHORD_NOTE_TRANSPOSE_LAST_CHORD == (int)WhenSingleChordNote::TRANSPOSE_LAST_CHORD);
+static_assert((int)ARPLIGNER_PATTERN_NOTES_MAPPING_WHITE_NOTE_TO_DEGREE == (int)PatternNotesMapping::WHITE_NOTE_TO_DEGREE);
+static_assert((int)ARPLIGNER_PATTERN_NOTES_WRAPAROUND_AFTER_ALL_CHORD_DEGREES == (int)PatternNotesWraparound::AFTER_ALL_CHORD_DEGREES);
+static_assert((int)ARPLIGNER_UNMAPPED_NOTES_PLAY_FULL_CHORD_UP_TO_NOTE == (int)UnmappedNotesBehaviour::PLAY_FULL_CHORD_UP_TO_NOTE);
+
+struct ArplignerEngine {
+  NoteEngine engine;
+};
+
+static bool isInRange(int value, int max) {
+  return value >= 0 && value <= max;
+}
+
+int arpligner_api_version(void) {
+  return ARPLIGNER_API_VERSION;
+}
+
+void arpligner_default_settings(ArplignerSettings* settings) {
+  NoteEngineSettings defaults;
+  settings->when_no_chord_note = defaults.whenNoChordNote;
+  settings->when_single_chord_note = defaults.whenSingleChordNote;
+  settings->reference_note = defaults.mapping.referenceNote;
+  settings->pattern_notes_mapping = defaults.mapping.mappingMode;
+  settings->pattern_notes_wraparound = defaults.mapping.wrapMode;
+  settings->unmapped_notes_behaviour = defaults.mapping.unmappedBeh;
+}
+
+ArplignerEngine* arpligner_engine_create(void) {
+  // No exception may go through the C interface
+  return new (std::nothrow) ArplignerEngine();
+}
+
+void arpligner_engine_destroy(ArplignerEngine* engine) {
+  delete engine;
+}
+
+int arpligner_engine_set_settings(ArplignerEngine* engine, const ArplignerSettings* settings) {
+  if (!isInRange(settings->when_no_chord_note, ARPLIGNER_WHEN_NO_CHORD_NOTE_LATCH_LAST_CHORD) ||
+    !isInRange(settings->when_single_chord_note, ARPLIGNER_WHEN_SINGLE_CHORD_NOTE_TRANSPOSE_LAST_CHORD) ||
+    !isInRange(settings->reference_note, NumMidiNotes - 1) ||
+    !isInRange(settings->pattern_notes_mapping, ARPLIGNER_PATTERN_NOTES_MAPPING_WHITE_NOTE_TO_DEGREE) ||
+    !isInRange(settings->pattern_notes_wraparound, ARPLIGNER_PATTERN_NOTES_WRAPAROUND_MAX) ||
+    !isInRange(settings->unmapped_notes_behaviour, ARPLIGNER_UNMAPPED_NOTES_PLAY_FULL_CHORD_UP_TO_NOTE))
+    return -1;
+
+  NoteEngineSettings res;
+  res.whenNoChordNote = (WhenNoChordNote::Enum)settings->when_no_chord_note;
+  res.whenSingleChordNote = (WhenSingleChordNote::Enum)settings->when_single_chord_note;
+  res.mapping.referenceNote = settings->reference_note;
+  res.mapping.mappingMode = (PatternNotesMapping::Enum)settings->pattern_notes_mapping;
+  res.mapping.wrapMode = (PatternNotesWraparound::Enum)settings->pattern_notes_wraparound;
+  res.mapping.unmappedBeh = (UnmappedNotesBehaviour::Enum)settings->unmapped_notes_behaviour;
+  engine->engine.setSettings(res);
+  return 0;
+}
+
+void arpligner_engine_add_chord_events(ArplignerEngine* engine,
+  const ArplignerMidiEvent* events, size_t num_events) {
+  engine->engine.addChordEvents({ events, num_events });
+}
+
+void arpligner_engine_map_pattern_events(ArplignerEngine* engine,
+  const ArplignerMidiEvent* input, size_t num_input,
+  ArplignerMidiEvent* output, size_t output_capacity,
+  size_t* num_read, size_t* num_written) {
+  auto res = engine->engine.mapPatternEvents({ input, num_input }, { output, output_capacity });
+  *num_read = res.numRead;
+  *num_written = res.numWritten;
+}
+
+void arpligner_engine_reset(ArplignerEngine* engine) {
+  engine->engine.reset();
+}
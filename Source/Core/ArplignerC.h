@@ -0,0 +1,131 @@
+/*
+  ==============================================================================
+
+    ArplignerC.h
+
+    A C interface to the note engine (see NoteEngine.h), to embed Arpligner's
+    chord tracking and pattern mapping in programs that are not plugin hosts.
+
+    An engine only allocates when it is created. None of the functions lock
+    anything, so they can be called from a real-time thread, but an engine must
+    not be used by several threads at once.
+
+  ==============================================================================
+*/
+
+#ifndef ARPLIGNER_C_H
+#define ARPLIGNER_C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Bumped whenever a change breaks programs built against a previous version
+   of this header */
+#define ARPLIGNER_API_VERSION 1
+
+/* A MIDI message of at most 3 bytes, at some sample position. Messages of
+   other sizes (like sysex) can't be passed to the engine */
+typedef struct ArplignerMidiEvent {
+  int32_t sample_position;
+  uint8_t data[3];
+  uint8_t num_bytes;
+} ArplignerMidiEvent;
+
+/* The values of the settings are the indexes of the corresponding plugin
+   parameters */
+enum {
+  ARPLIGNER_WHEN_NO_CHORD_NOTE_SILENCE = 0,
+  ARPLIGNER_WHEN_NO_CHORD_NOTE_USE_PATTERN_AS_NOTES = 1,
+  ARPLIGNER_WHEN_NO_CHORD_NOTE_LATCH_LAST_CHORD = 2
+};
+
+enum {
+  ARPLIGNER_WHEN_SINGLE_CHORD_NOTE_SILENCE = 0,
+  ARPLIGNER_WHEN_SINGLE_CHORD_NOTE_USE_PATTERN_AS_NOTES = 1,
+  ARPLIGNER_WHEN_SINGLE_CHORD_NOTE_USE_AS_IS = 2,
+  ARPLIGNER_WHEN_SINGLE_CHORD_NOTE_POWERCHORD = 3,
+  ARPLIGNER_WHEN_SINGLE_CHORD_NOTE_TRANSPOSE_LAST_CHORD = 4
+};
+
+enum {
+  ARPLIGNER_PATTERN_NOTES_MAPPING_ALWAYS_LEAVE_UNMAPPED = 0,
+  ARPLIGNER_PATTERN_NOTES_MAPPING_SEMITONE_TO_DEGREE = 1,
+  ARPLIGNER_PATTERN_NOTES_MAPPING_WHITE_NOTE_TO_DEGREE = 2
+};
+
+/* Values from 2 to ARPLIGNER_PATTERN_NOTES_WRAPAROUND_MAX are fixed
+   wraparounds, like the "[Fixed]" values of the plugin parameter */
+enum {
+  ARPLIGNER_PATTERN_NOTES_WRAPAROUND_NONE = 0,
+  ARPLIGNER_PATTERN_NOTES_WRAPAROUND_AFTER_ALL_CHORD_DEGREES = 1,
+  ARPLIGNER_PATTERN_NOTES_WRAPAROUND_MAX = 12
+};
+
+enum {
+  ARPLIGNER_UNMAPPED_NOTES_SILENCE = 0,
+  ARPLIGNER_UNMAPPED_NOTES_USE_AS_IS = 1,
+  ARPLIGNER_UNMAPPED_NOTES_TRANSPOSE_FROM_FIRST_DEGREE = 2,
+  ARPLIGNER_UNMAPPED_NOTES_PLAY_FULL_CHORD_UP_TO_NOTE = 3
+};
+
+typedef struct ArplignerSettings {
+  int when_no_chord_note;
+  int when_single_chord_note;
+  /* The pattern note mapped to the first degree of the chord (0 to 127) */
+  int reference_note;
+  int pattern_notes_mapping;
+  int pattern_notes_wraparound;
+  int unmapped_notes_behaviour;
+} ArplignerSettings;
+
+typedef struct ArplignerEngine ArplignerEngine;
+
+/* The version of this interface the library was built with. Programs should
+   check that it is ARPLIGNER_API_VERSION */
+int arpligner_api_version(void);
+
+/* The settings of the plugin's default configuration */
+void arpligner_default_settings(ArplignerSettings* settings);
+
+/* Returns NULL if the engine couldn't be allocated. An engine starts with the
+   default settings, no chord and no pattern note held */
+ArplignerEngine* arpligner_engine_create(void);
+
+/* engine may be NULL */
+void arpligner_engine_destroy(ArplignerEngine* engine);
+
+/* Returns 0, or -1 (and leaves the settings unchanged) if one of the settings
+   is out of range */
+int arpligner_engine_set_settings(ArplignerEngine* engine, const ArplignerSettings* settings);
+
+/* Note ONs and note OFFs, on any channel, update the chord notes being held,
+   which then make the current chord. The other events are ignored */
+void arpligner_engine_add_chord_events(ArplignerEngine* engine,
+  const ArplignerMidiEvent* events, size_t num_events);
+
+/* Maps the pattern events of input, in order, to the current chord, and
+   writes the resulting events to output, each one at the position of the event
+   it comes from. The events that are not notes are written as they are.
+
+   Stops before the first input event whose resulting events don't all fit in
+   output. *num_read is set to the number of input events processed, and
+   *num_written to the number of events written to output, so that the
+   remaining input events can be given again once output is flushed */
+void arpligner_engine_map_pattern_events(ArplignerEngine* engine,
+  const ArplignerMidiEvent* input, size_t num_input,
+  ArplignerMidiEvent* output, size_t output_capacity,
+  size_t* num_read, size_t* num_written);
+
+/* Forgets the chord and what the pattern notes being held were mapped to. The
+   settings are kept */
+void arpligner_engine_reset(ArplignerEngine* engine);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,157 @@
+/*
+  ==============================================================================
+
+    Chord.h
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <bit>
+#include <cstdint>
+
+using NoteNumber = int;
+
+const int NumMidiNotes = 128;
+
+
+// A set of MIDI notes, stored as a 128-bit mask (one bit per note number).
+// Notes are always iterated in ascending order, the n-th note being the n-th
+// degree of the chord. A Chord is plain data, so copying or sharing it between
+// threads is just a matter of copying 16 bytes.
+class Chord {
+private:
+  uint64_t mBits[2] = { 0, 0 };
+
+  static bool isInMidiRange(NoteNumber nn) {
+    return nn >= 0 && nn < NumMidiNotes;
+  }
+
+public:
+  Chord() = default;
+
+  // From the masks of notes 0 to 63 and 64 to 127
+  Chord(uint64_t lowNotes, uint64_t highNotes) : mBits{ lowNotes, highNotes } {
+  }
+
+  class Iterator {
+  private:
+    uint64_t mBits[2];
+
+  public:
+    Iterator(uint64_t lo, uint64_t hi) : mBits{ lo, hi } {
+    }
+
+    NoteNumber operator*() const {
+      return mBits[0] ? std::countr_zero(mBits[0])
+                      : 64 + std::countr_zero(mBits[1]);
+    }
+
+    Iterator& operator++() {
+      // Clears the lowest note
+      if (mBits[0])
+        mBits[0] &= mBits[0] - 1;
+      else
+        mBits[1] &= mBits[1] - 1;
+      return *this;
+    }
+
+    bool operator!=(const Iterator& other) const {
+      return mBits[0] != other.mBits[0] || mBits[1] != other.mBits[1];
+    }
+  };
+
+  Iterator begin() const { return Iterator(mBits[0], mBits[1]); }
+  Iterator end() const { return Iterator(0, 0); }
+
+  int size() const {
+    return std::popcount(mBits[0]) + std::popcount(mBits[1]);
+  }
+
+  bool contains(NoteNumber nn) const {
+    return isInMidiRange(nn) && ((mBits[nn >> 6] >> (nn & 63)) & 1);
+  }
+
+  // Notes outside of the MIDI range are ignored
+  void add(NoteNumber nn) {
+    if (isInMidiRange(nn))
+      mBits[nn >> 6] |= uint64_t(1) << (nn & 63);
+  }
+
+  void remove(NoteNumber nn) {
+    if (isInMidiRange(nn))
+      mBits[nn >> 6] &= ~(uint64_t(1) << (nn & 63));
+  }
+
+  void clear() {
+    mBits[0] = mBits[1] = 0;
+  }
+
+  // The note corresponding to some degree of the chord. Like SortedSet,
+  // returns 0 if the degree is out of range
+  NoteNumber operator[](int degree) const {
+    if (degree < 0)
+      return 0;
+    int word = 0;
+    int numLowNotes = std::popcount(mBits[0]);
+    if (degree >= numLowNotes) {
+      degree -= numLowNotes;
+      word = 1;
+    }
+    uint64_t bits = mBits[word];
+    if (degree >= std::popcount(bits))
+      return 0;
+    for (; degree > 0; degree--)
+      bits &= bits - 1;
+    return 64 * word + std::countr_zero(bits);
+  }
+
+  // The notes of the chord that are lower than or equal to nn
+  Chord upTo(NoteNumber nn) const {
+    Chord res;
+    if (nn < 0)
+      return res;
+    if (nn >= NumMidiNotes - 1)
+      return *this;
+    if (nn < 64) {
+      res.mBits[0] = mBits[0] & (~uint64_t(0) >> (63 - nn));
+    }
+    else {
+      res.mBits[0] = mBits[0];
+      res.mBits[1] = mBits[1] & (~uint64_t(0) >> (127 - nn));
+    }
+    return res;
+  }
+
+  // The chord transposed by some number of semitones. Notes that would end up
+  // outside of the MIDI range are dropped
+  Chord transposed(int offset) const {
+    Chord res;
+    if (offset >= NumMidiNotes || offset <= -NumMidiNotes)
+      return res;
+    if (offset >= 64) {
+      res.mBits[1] = mBits[0] << (offset - 64);
+    }
+    else if (offset > 0) {
+      res.mBits[1] = (mBits[1] << offset) | (mBits[0] >> (64 - offset));
+      res.mBits[0] = mBits[0] << offset;
+    }
+    else if (offset == 0) {
+      res = *this;
+    }
+    else if (offset > -64) {
+      res.mBits[0] = (mBits[0] >> -offset) | (mBits[1] << (64 + offset));
+      res.mBits[1] = mBits[1] >> -offset;
+    }
+    else {
+      res.mBits[0] = mBits[1] >> (-offset - 64);
+    }
+    return res;
+  }
+
+  bool operator==(const Chord& other) const {
+    return mBits[0] == other.mBits[0] && mBits[1] == other.mBits[1];
+  }
+};
+
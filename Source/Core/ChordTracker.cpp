@@ -0,0 +1,65 @@
+#include "ChordTracker.h"
+
+bool ChordTracker::updateCurrentChord(WhenNoChordNote::Enum whenNoChordNoteVal,
+  WhenSingleChordNote::Enum whenSingleChordNoteVal) {
+  if (!mNeedsUpdate)
+    return false;
+
+  Chord& curChord = mCurrent.chord;
+  mCurrent.shouldSilence = false;
+  mCurrent.shouldProcess = true;
+
+  Chord newChord = mCounters.heldNotes();
+
+  switch (newChord.size()) {
+  case 0:
+    // No chord notes
+    switch (whenNoChordNoteVal) {
+    case WhenNoChordNote::LATCH_LAST_CHORD:
+      if (curChord.size() == 0)
+        // No last chord known. We silence
+        mCurrent.shouldSilence = true;
+      break;
+    case WhenNoChordNote::USE_PATTERN_AS_NOTES:
+      mCurrent.shouldProcess = false;
+      break;
+    case WhenNoChordNote::SILENCE:
+      mCurrent.shouldSilence = true;
+      break;
+    }
+    break;
+
+  case 1:
+    // Just 1 chord note
+    switch (whenSingleChordNoteVal) {
+    case WhenSingleChordNote::TRANSPOSE_LAST_CHORD:
+      if (curChord.size() > 0)
+        curChord = curChord.transposed(newChord[0] - curChord[0]);
+      else // No last chord known. We silence
+        mCurrent.shouldSilence = true;
+      break;
+    case WhenSingleChordNote::POWERCHORD:
+      newChord.add(newChord[0] + 7);
+      curChord = newChord;
+      break;
+    case WhenSingleChordNote::USE_AS_IS:
+      curChord = newChord;
+      break;
+    case WhenSingleChordNote::USE_PATTERN_AS_NOTES:
+      mCurrent.shouldProcess = false;
+      break;
+    case WhenSingleChordNote::SILENCE:
+      mCurrent.shouldSilence = true;
+      break;
+    }
+    break;
+
+  default:
+    // "Normal" case: 2 chords notes or more
+    curChord = newChord;
+    break;
+  };
+
+  mNeedsUpdate = false;
+  return true;
+}
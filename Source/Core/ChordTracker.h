@@ -0,0 +1,86 @@
+/*
+  ==============================================================================
+
+    ChordTracker.h
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "Chord.h"
+#include "Kernels.h"
+#include "Modes.h"
+
+// Everything pattern notes need to know about the chord that is currently
+// playing
+struct ChordSnapshot {
+  Chord chord;
+  bool shouldProcess = true;
+  bool shouldSilence = false;
+};
+
+
+// Counts how many NOTE ONs without matching NOTE OFFs have been received for
+// each note. The set of notes whose counter is non-zero is only built when it
+// is needed, i.e. once per chord change rather than once per chord note
+class Counters {
+private:
+  uint8_t mCounts[NumMidiNotes] = {};
+
+public:
+  void increment(NoteNumber nn) {
+    if (nn >= 0 && nn < NumMidiNotes && mCounts[nn] < UINT8_MAX)
+      mCounts[nn]++;
+  }
+
+  void decrement(NoteNumber nn) {
+    if (nn >= 0 && nn < NumMidiNotes && mCounts[nn] > 0)
+      mCounts[nn]--;
+  }
+
+  Chord heldNotes() const {
+    return Kernels::best().heldNotes(mCounts);
+  }
+
+  void clear() {
+    for (auto& c : mCounts)
+      c = 0;
+  }
+};
+
+
+// Turns the chord notes being held into the chord pattern notes are mapped to,
+// following the WhenNoChordNote and WhenSingleChordNote modes
+class ChordTracker {
+private:
+  Counters mCounters;
+  ChordSnapshot mCurrent;
+  bool mNeedsUpdate = false;
+
+public:
+  void addChordNote(NoteNumber nn) {
+    mNeedsUpdate = true;
+    mCounters.increment(nn);
+  }
+
+  void rmChordNote(NoteNumber nn) {
+    mNeedsUpdate = true;
+    mCounters.decrement(nn);
+  }
+
+  // Returns whether the current chord had to be updated, i.e. whether chord
+  // notes were added or removed since the last update
+  bool updateCurrentChord(WhenNoChordNote::Enum, WhenSingleChordNote::Enum);
+
+  // Forgets the held notes and the current chord
+  void flush() {
+    mCounters.clear();
+    mCurrent = ChordSnapshot();
+    mNeedsUpdate = false;
+  }
+
+  const ChordSnapshot& getCurrentChord() const {
+    return mCurrent;
+  }
+};
@@ -0,0 +1,77 @@
+#include "Kernels.h"
+#include <cstdlib>
+#include <cstring>
+
+namespace Kernels {
+
+  // The reference implementations
+
+  static void mapDegreesScalar(const DegreeParams& params, int8_t* notesOut) {
+    DegreeSetup setup = setUpDegrees(params);
+    for (NoteNumber nn = 0; nn < NumMidiNotes; nn++) {
+      int shifted = setup.positions[nn] - setup.refPosition + setup.degreeOffset +
+        (nn < params.referenceNote ? setup.blackRefCorrection : 0);
+      int octave = shifted / params.numValidDegrees;
+      int degree = shifted - octave * params.numValidDegrees;
+      bool isMapped = degree < params.numChordDegrees && !(params.whiteKeysOnly && BlackKeyMask[nn]);
+      notesOut[nn] = isMapped
+        ? (int8_t)((params.degrees[degree] + 12 * (octave - setup.octaveOffset)) & (NumMidiNotes - 1))
+        : -1;
+    }
+  }
+
+  static Chord heldNotesScalar(const uint8_t* counts) {
+    uint64_t bits[2] = { 0, 0 };
+    for (NoteNumber nn = 0; nn < NumMidiNotes; nn++)
+      if (counts[nn] != 0)
+        bits[nn >> 6] |= uint64_t(1) << (nn & 63);
+    return Chord(bits[0], bits[1]);
+  }
+
+  static const KernelSet ScalarKernels = {
+    InstructionSet::SCALAR, "scalar", &mapDegreesScalar, &heldNotesScalar
+  };
+
+  const KernelSet* get(InstructionSet instructionSet) {
+    switch (instructionSet) {
+    case InstructionSet::SCALAR:
+      return &ScalarKernels;
+#if ARPLIGNER_KERNELS_X64
+    case InstructionSet::SSE2:
+      // Part of x64
+      return &Sse2Kernels;
+    case InstructionSet::AVX2:
+      return cpuSupportsAvx2() ? &Avx2Kernels : nullptr;
+#endif
+    default:
+      return nullptr;
+    }
+  }
+
+  static const KernelSet* selectKernels() {
+    if (const char* forced = std::getenv("ARPLIGNER_KERNELS")) {
+      for (int i = 0; i < NumInstructionSets; i++) {
+        auto* kernels = get((InstructionSet)i);
+        if (kernels != nullptr && std::strcmp(kernels->name, forced) == 0)
+          return kernels;
+      }
+    }
+    // The instruction sets are listed from the least to the most capable
+    for (int i = NumInstructionSets - 1; i > 0; i--)
+      if (auto* kernels = get((InstructionSet)i))
+        return kernels;
+    return &ScalarKernels;
+  }
+
+  const KernelSet& best() {
+    // Selected on first use, so that this works from the static initialisers
+    // of other files too
+    static const KernelSet* const selected = selectKernels();
+    return *selected;
+  }
+
+  // Still selected while the library is loaded, so that the audio threads
+  // never have to query the CPU
+  [[maybe_unused]] static const KernelSet& PreselectedKernels = best();
+
+} // end namespace Kernels
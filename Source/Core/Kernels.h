@@ -0,0 +1,130 @@
+/*
+  ==============================================================================
+
+    Kernels.h
+
+    The loops of the note engine that work on all the MIDI notes at once, with
+    an implementation for each instruction set: SSE2 and AVX2 on x64, and a
+    scalar one everywhere else (arm64 included). The best implementation the
+    CPU supports is selected once, when the library is loaded. The scalar one
+    is the reference: the others must give exactly the same results, which
+    ArplignerFuzz checks.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include "Chord.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+  #define ARPLIGNER_KERNELS_X64 1
+#endif
+
+namespace Kernels {
+  enum class InstructionSet {
+    SCALAR,
+    SSE2,
+    AVX2
+  };
+
+  const int NumInstructionSets = 3;
+
+  // What mapping pattern notes to chord degrees depends on
+  struct DegreeParams {
+    // The notes of the chord in ascending order, i.e. its degrees. There must
+    // be at least one
+    uint8_t degrees[NumMidiNotes];
+    int numChordDegrees;
+    // The degrees wrap around, one octave up or down, every that many degrees.
+    // Without wraparound it is NoWraparound, more than any degree number can
+    // reach, so that only the degrees that are in the chord get mapped
+    int numValidDegrees;
+    NoteNumber referenceNote;
+    // Whether the black keys are left unmapped and not counted as degrees
+    bool whiteKeysOnly;
+  };
+
+  const int NoWraparound = 2 * NumMidiNotes;
+
+  struct KernelSet {
+    InstructionSet instructionSet;
+    const char* name;
+
+    // For each input pattern note, the note its degree (counted from the
+    // reference note) maps to, or -1 if it maps to none. Mapped notes that
+    // end up outside of the MIDI range wrap around (see Mapping.cpp)
+    void (*mapDegrees)(const DegreeParams&, int8_t* notesOut);
+
+    // The notes whose count is not zero, from one count per MIDI note
+    Chord (*heldNotes)(const uint8_t* counts);
+  };
+
+  // The kernels selected for this CPU. The ARPLIGNER_KERNELS environment
+  // variable can force some instruction set by name (e.g. "scalar")
+  const KernelSet& best();
+
+  // The kernels for some instruction set, or nullptr if they are not built for
+  // this architecture or if the CPU doesn't support them
+  const KernelSet* get(InstructionSet);
+
+  // For each MIDI note, the number of white keys below it, which is what
+  // degrees are counted in when only the white keys are mapped
+  inline constexpr std::array<uint8_t, NumMidiNotes> WhiteKeysBelow = [] {
+    std::array<uint8_t, NumMidiNotes> res{};
+    const int InOctave[12] = { 0, 1, 1, 2, 2, 3, 4, 4, 5, 5, 6, 6 };
+    for (int nn = 0; nn < NumMidiNotes; nn++)
+      res[nn] = (uint8_t)((nn / 12) * 7 + InOctave[nn % 12]);
+    return res;
+  }();
+
+  // For each MIDI note, the number of keys below it, which is what degrees
+  // are counted in when all the keys are mapped
+  inline constexpr std::array<uint8_t, NumMidiNotes> KeysBelow = [] {
+    std::array<uint8_t, NumMidiNotes> res{};
+    for (int nn = 0; nn < NumMidiNotes; nn++)
+      res[nn] = (uint8_t)nn;
+    return res;
+  }();
+
+  // 0xff for the black keys, 0 for the white ones
+  inline constexpr std::array<uint8_t, NumMidiNotes> BlackKeyMask = [] {
+    std::array<uint8_t, NumMidiNotes> res{};
+    for (int nn = 0; nn < NumMidiNotes; nn++)
+      res[nn] = ((1 << (nn % 12)) & 0x054a) ? 0xff : 0;
+    return res;
+  }();
+
+  // What every implementation of mapDegrees computes first. Degree numbers
+  // are shifted up by a whole number of wraparounds, so that they are never
+  // negative and the octave of a degree is a plain (truncating) division
+  struct DegreeSetup {
+    // WhiteKeysBelow or KeysBelow
+    const uint8_t* positions;
+    int refPosition;
+    // When counting white keys down from a black reference note, the first
+    // step down doesn't count (see Mapping::mapPatternNote)
+    int blackRefCorrection;
+    int octaveOffset;
+    int degreeOffset;
+  };
+
+  inline DegreeSetup setUpDegrees(const DegreeParams& params) {
+    DegreeSetup res;
+    res.positions = params.whiteKeysOnly ? WhiteKeysBelow.data() : KeysBelow.data();
+    res.refPosition = res.positions[params.referenceNote];
+    res.blackRefCorrection = params.whiteKeysOnly && BlackKeyMask[params.referenceNote] ? 1 : 0;
+    res.octaveOffset = (NumMidiNotes + params.numValidDegrees - 1) / params.numValidDegrees;
+    res.degreeOffset = res.octaveOffset * params.numValidDegrees;
+    return res;
+  }
+
+  // Defined in the file of each instruction set
+#if ARPLIGNER_KERNELS_X64
+  extern const KernelSet Sse2Kernels;
+  extern const KernelSet Avx2Kernels;
+  bool cpuSupportsAvx2();
+#endif
+}
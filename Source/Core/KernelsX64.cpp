@@ -0,0 +1,186 @@
+#include "Kernels.h"
+
+#if ARPLIGNER_KERNELS_X64
+
+#include <immintrin.h>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+  #include <intrin.h>
+  // MSVC accepts the AVX2 intrinsics anywhere
+  #define ARPLIGNER_TARGET_AVX2
+#else
+  // Only these functions are compiled for AVX2, the rest of the binary still
+  // runs on any x64 CPU
+  #define ARPLIGNER_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace Kernels {
+
+  // SSE2, which every x64 CPU has
+
+  static void mapDegreesSse2(const DegreeParams& params, int8_t* notesOut) {
+    DegreeSetup setup = setUpDegrees(params);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i allOnes = _mm_set1_epi32(-1);
+    const __m128i iota = _mm_setr_epi32(0, 1, 2, 3);
+    const __m128i refNote = _mm_set1_epi32(params.referenceNote);
+    const __m128i shift = _mm_set1_epi32(setup.degreeOffset - setup.refPosition);
+    const __m128i correction = _mm_set1_epi32(setup.blackRefCorrection);
+    const __m128i numChordDegrees = _mm_set1_epi32(params.numChordDegrees);
+    const __m128i octaveOffset = _mm_set1_epi32(setup.octaveOffset);
+    const __m128i noteMask = _mm_set1_epi32(NumMidiNotes - 1);
+    const __m128 numValidDegrees = _mm_set1_ps((float)params.numValidDegrees);
+    const __m128i blackKeysUnmapped = _mm_set1_epi8(params.whiteKeysOnly ? (char)0xff : 0);
+    alignas(16) int32_t degrees[4];
+
+    // 16 input notes at a time, in 4 vectors of 4
+    for (int nn = 0; nn < NumMidiNotes; nn += 16) {
+      __m128i positions8 = _mm_loadu_si128((const __m128i*)(setup.positions + nn));
+      __m128i unmapped8 = _mm_and_si128(_mm_loadu_si128((const __m128i*)(BlackKeyMask.data() + nn)), blackKeysUnmapped);
+      __m128i positions16[2] = { _mm_unpacklo_epi8(positions8, zero), _mm_unpackhi_epi8(positions8, zero) };
+      __m128i unmapped16[2] = { _mm_unpacklo_epi8(unmapped8, unmapped8), _mm_unpackhi_epi8(unmapped8, unmapped8) };
+      __m128i results[4];
+
+      for (int k = 0; k < 4; k++) {
+        const __m128i& p16 = positions16[k / 2];
+        const __m128i& u16 = unmapped16[k / 2];
+        __m128i positions = (k % 2 == 0) ? _mm_unpacklo_epi16(p16, zero) : _mm_unpackhi_epi16(p16, zero);
+        __m128i unmapped = (k % 2 == 0) ? _mm_unpacklo_epi16(u16, u16) : _mm_unpackhi_epi16(u16, u16);
+        __m128i notes = _mm_add_epi32(_mm_set1_epi32(nn + 4 * k), iota);
+
+        __m128i shifted = _mm_add_epi32(_mm_add_epi32(positions, shift),
+          _mm_and_si128(_mm_cmplt_epi32(notes, refNote), correction));
+        // Exact, as all the values are small integers
+        __m128 shiftedF = _mm_cvtepi32_ps(shifted);
+        __m128i octave = _mm_cvttps_epi32(_mm_div_ps(shiftedF, numValidDegrees));
+        __m128i degree = _mm_cvttps_epi32(_mm_sub_ps(shiftedF, _mm_mul_ps(_mm_cvtepi32_ps(octave), numValidDegrees)));
+        __m128i isMapped = _mm_andnot_si128(unmapped, _mm_cmplt_epi32(degree, numChordDegrees));
+
+        // SSE2 has no gather, so the chord notes are read one by one
+        _mm_store_si128((__m128i*)degrees, _mm_and_si128(degree, isMapped));
+        __m128i degreeNotes = _mm_setr_epi32(params.degrees[degrees[0]], params.degrees[degrees[1]],
+          params.degrees[degrees[2]], params.degrees[degrees[3]]);
+
+        // No 32-bit multiplication either: 12 * octave = 8 * octave + 4 * octave
+        octave = _mm_sub_epi32(octave, octaveOffset);
+        __m128i mapped = _mm_add_epi32(degreeNotes, _mm_add_epi32(_mm_slli_epi32(octave, 3), _mm_slli_epi32(octave, 2)));
+        mapped = _mm_and_si128(mapped, noteMask);
+        results[k] = _mm_or_si128(_mm_and_si128(isMapped, mapped), _mm_andnot_si128(isMapped, allOnes));
+      }
+
+      // All the values are between -1 and 127, so saturation never kicks in
+      __m128i packed = _mm_packs_epi16(_mm_packs_epi32(results[0], results[1]), _mm_packs_epi32(results[2], results[3]));
+      _mm_storeu_si128((__m128i*)(notesOut + nn), packed);
+    }
+  }
+
+  static Chord heldNotesSse2(const uint8_t* counts) {
+    const __m128i zero = _mm_setzero_si128();
+    uint64_t bits[2] = { 0, 0 };
+    for (int k = 0; k < 8; k++) {
+      __m128i counts16 = _mm_loadu_si128((const __m128i*)(counts + 16 * k));
+      uint64_t isZero = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(counts16, zero));
+      bits[k / 4] |= (~isZero & 0xffff) << (16 * (k % 4));
+    }
+    return Chord(bits[0], bits[1]);
+  }
+
+  const KernelSet Sse2Kernels = {
+    InstructionSet::SSE2, "sse2", &mapDegreesSse2, &heldNotesSse2
+  };
+
+
+  // AVX2
+
+  ARPLIGNER_TARGET_AVX2
+  static void mapDegreesAvx2(const DegreeParams& params, int8_t* notesOut) {
+    DegreeSetup setup = setUpDegrees(params);
+    // Gathered 32 bits at a time. Only the mapped degrees are read
+    alignas(32) int32_t degrees[NumMidiNotes];
+    for (int d = 0; d < params.numChordDegrees; d++)
+      degrees[d] = params.degrees[d];
+
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i allOnes = _mm256_set1_epi32(-1);
+    const __m256i iota = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i refNote = _mm256_set1_epi32(params.referenceNote);
+    const __m256i shift = _mm256_set1_epi32(setup.degreeOffset - setup.refPosition);
+    const __m256i correction = _mm256_set1_epi32(setup.blackRefCorrection);
+    const __m256i numChordDegrees = _mm256_set1_epi32(params.numChordDegrees);
+    const __m256i octaveOffset = _mm256_set1_epi32(setup.octaveOffset);
+    const __m256i twelve = _mm256_set1_epi32(12);
+    const __m256i noteMask = _mm256_set1_epi32(NumMidiNotes - 1);
+    const __m256 numValidDegrees = _mm256_set1_ps((float)params.numValidDegrees);
+    const __m256i blackKeysUnmapped = _mm256_set1_epi32(params.whiteKeysOnly ? -1 : 0);
+
+    // 32 input notes at a time, in 4 vectors of 8
+    for (int nn = 0; nn < NumMidiNotes; nn += 32) {
+      __m256i results[4];
+      for (int k = 0; k < 4; k++) {
+        int first = nn + 8 * k;
+        __m256i positions = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(setup.positions + first)));
+        // Sign extension turns 0xff into -1
+        __m256i unmapped = _mm256_and_si256(blackKeysUnmapped,
+          _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*)(BlackKeyMask.data() + first))));
+        __m256i notes = _mm256_add_epi32(_mm256_set1_epi32(first), iota);
+
+        __m256i shifted = _mm256_add_epi32(_mm256_add_epi32(positions, shift),
+          _mm256_and_si256(_mm256_cmpgt_epi32(refNote, notes), correction));
+        __m256 shiftedF = _mm256_cvtepi32_ps(shifted);
+        __m256i octave = _mm256_cvttps_epi32(_mm256_div_ps(shiftedF, numValidDegrees));
+        __m256i degree = _mm256_cvttps_epi32(_mm256_sub_ps(shiftedF, _mm256_mul_ps(_mm256_cvtepi32_ps(octave), numValidDegrees)));
+        __m256i isMapped = _mm256_andnot_si256(unmapped, _mm256_cmpgt_epi32(numChordDegrees, degree));
+
+        __m256i degreeNotes = _mm256_mask_i32gather_epi32(zero, degrees, _mm256_and_si256(degree, isMapped), isMapped, 4);
+        __m256i mapped = _mm256_add_epi32(degreeNotes, _mm256_mullo_epi32(_mm256_sub_epi32(octave, octaveOffset), twelve));
+        mapped = _mm256_and_si256(mapped, noteMask);
+        results[k] = _mm256_blendv_epi8(allOnes, mapped, isMapped);
+      }
+
+      // The packs work within each 128-bit lane, which the permutation undoes
+      __m256i packed = _mm256_packs_epi16(_mm256_packs_epi32(results[0], results[1]),
+        _mm256_packs_epi32(results[2], results[3]));
+      packed = _mm256_permutevar8x32_epi32(packed, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+      _mm256_storeu_si256((__m256i*)(notesOut + nn), packed);
+    }
+  }
+
+  ARPLIGNER_TARGET_AVX2
+  static Chord heldNotesAvx2(const uint8_t* counts) {
+    const __m256i zero = _mm256_setzero_si256();
+    uint64_t bits[2] = { 0, 0 };
+    for (int k = 0; k < 4; k++) {
+      __m256i counts32 = _mm256_loadu_si256((const __m256i*)(counts + 32 * k));
+      uint32_t isZero = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(counts32, zero));
+      bits[k / 2] |= (uint64_t)(~isZero) << (32 * (k % 2));
+    }
+    return Chord(bits[0], bits[1]);
+  }
+
+  const KernelSet Avx2Kernels = {
+    InstructionSet::AVX2, "avx2", &mapDegreesAvx2, &heldNotesAvx2
+  };
+
+  bool cpuSupportsAvx2() {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+      return false;
+    // The OS must also save the AVX registers when switching threads
+    __cpuid(info, 1);
+    bool hasOsxsaveAndAvx = (info[2] & (1 << 27)) && (info[2] & (1 << 28));
+    if (!hasOsxsaveAndAvx || (_xgetbv(0) & 6) != 6)
+      return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    // May be called by a static initializer, before the CPU model is known
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+  }
+
+} // end namespace Kernels
+
+#endif
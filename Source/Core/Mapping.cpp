@@ -0,0 +1,169 @@
+#include "Mapping.h"
+#include <array>
+#include <cmath>
+#include "Kernels.h"
+
+
+// Functions that compute the mappings of input pattern notes:
+namespace Mapping {
+
+  // Notes outside of the MIDI range wrap around, as they would when set in a
+  // MidiMessage
+  void addMappedNote(Chord& thisNoteMappings, NoteNumber nn) {
+    thisNoteMappings.add(nn & (NumMidiNotes - 1));
+  }
+
+  void mapToChordDegree(PatternNotesWraparound::Enum wrapMode,
+    const Chord& curChord,
+    int degreeNum,
+    Chord& thisNoteMappings) {
+    int numChordDegrees = curChord.size();
+
+    if ((degreeNum < 0 || degreeNum >= numChordDegrees) &&
+      wrapMode == PatternNotesWraparound::NO_WRAPAROUND ||
+      numChordDegrees == 0)
+      return;
+
+    int numValidDegrees =
+      (wrapMode <= PatternNotesWraparound::AFTER_ALL_CHORD_DEGREES)
+      ? numChordDegrees
+      : wrapMode;
+    int wantedDegree;
+    if (degreeNum >= 0)
+      wantedDegree = degreeNum % numValidDegrees;
+    else {
+      int absRem = (-degreeNum) % numValidDegrees;
+      wantedDegree = (absRem == 0) ? 0 : numValidDegrees - absRem;
+    }
+    int wantedOctaveShift = std::floor((float)degreeNum / (float)numValidDegrees);
+
+    if (wantedDegree < numChordDegrees)
+      addMappedNote(thisNoteMappings, curChord[wantedDegree] + 12 * wantedOctaveShift);
+  }
+
+  void mapPatternNote(NoteNumber referenceNote,
+    PatternNotesMapping::Enum mappingMode,
+    PatternNotesWraparound::Enum wrapMode,
+    UnmappedNotesBehaviour::Enum unmappedBeh,
+    const Chord& curChord,
+    NoteNumber noteCodeIn,
+    Chord& thisNoteMappings) {
+    int offsetFromRef = noteCodeIn - referenceNote;
+
+    switch (mappingMode) {
+    case PatternNotesMapping::ALWAYS_LEAVE_UNMAPPED:
+      break;
+    case PatternNotesMapping::WHITE_NOTE_TO_DEGREE:
+      if (!isBlackKey(noteCodeIn)) {
+        // We need to correct the [referenceNote,noteCodeIn] interval for the amount
+        // of black keys it contains:
+        int sign = (offsetFromRef < 0) ? -1 : 1;
+        int absOffset = sign * offsetFromRef;
+        for (int i = referenceNote; i != noteCodeIn; i += sign)
+          if (isBlackKey(i))
+            absOffset--;
+        mapToChordDegree(wrapMode, curChord, sign * absOffset, thisNoteMappings);
+      }
+      break;
+    default:
+      mapToChordDegree(wrapMode, curChord, offsetFromRef, thisNoteMappings);
+      break;
+    }
+
+    if (thisNoteMappings.size() == 0) { // If the note has not been mapped yet:
+      switch (unmappedBeh) {
+      case UnmappedNotesBehaviour::SILENCE:
+        break;
+      case UnmappedNotesBehaviour::PLAY_FULL_CHORD_UP_TO_NOTE:
+        for (NoteNumber chdNote : curChord.upTo(noteCodeIn))
+          thisNoteMappings.add(chdNote);
+        break;
+      case UnmappedNotesBehaviour::TRANSPOSE_FROM_FIRST_DEGREE:
+        addMappedNote(thisNoteMappings, curChord[0] + offsetFromRef);
+        break;
+      case UnmappedNotesBehaviour::USE_AS_IS:
+        thisNoteMappings.add(noteCodeIn);
+        break;
+      }
+    }
+  }
+
+  /* Table kernels: the same computations as mapPatternNote, but for all the
+     input notes at once and instantiated for each combination of modes, so
+     that no mode is tested in the loop over the input notes. The degrees the
+     notes map to are computed for all of them at once, by the vectorised
+     kernel selected for the CPU (see Kernels.h). */
+
+  template <PatternNotesMapping::Enum MappingMode, UnmappedNotesBehaviour::Enum UnmappedBeh>
+  void tableKernel(const MappingSettings& settings, const Chord& curChord, Chord* outputs) {
+    int numChordDegrees = curChord.size();
+    // For each input note, the note its degree maps to, or -1
+    int8_t mappedNotes[NumMidiNotes];
+    if (MappingMode == PatternNotesMapping::ALWAYS_LEAVE_UNMAPPED || numChordDegrees == 0) {
+      std::fill(std::begin(mappedNotes), std::end(mappedNotes), (int8_t)-1);
+    }
+    else {
+      Kernels::DegreeParams params{};
+      for (NoteNumber nn : curChord)
+        params.degrees[params.numChordDegrees++] = (uint8_t)nn;
+      params.numValidDegrees =
+        settings.wrapMode == PatternNotesWraparound::NO_WRAPAROUND ? Kernels::NoWraparound
+        : settings.wrapMode == PatternNotesWraparound::AFTER_ALL_CHORD_DEGREES ? numChordDegrees
+        : (int)settings.wrapMode;
+      params.referenceNote = settings.referenceNote;
+      params.whiteKeysOnly = MappingMode == PatternNotesMapping::WHITE_NOTE_TO_DEGREE;
+      Kernels::best().mapDegrees(params, mappedNotes);
+    }
+
+    NoteNumber firstDegree = curChord[0];
+    for (NoteNumber noteCodeIn = 0; noteCodeIn < NumMidiNotes; noteCodeIn++) {
+      Chord& out = outputs[noteCodeIn];
+      out.clear();
+      if (mappedNotes[noteCodeIn] >= 0) {
+        out.add(mappedNotes[noteCodeIn]);
+        continue;
+      }
+
+      if constexpr (UnmappedBeh == UnmappedNotesBehaviour::PLAY_FULL_CHORD_UP_TO_NOTE)
+        out = curChord.upTo(noteCodeIn);
+      else if constexpr (UnmappedBeh == UnmappedNotesBehaviour::TRANSPOSE_FROM_FIRST_DEGREE)
+        addMappedNote(out, firstDegree + noteCodeIn - settings.referenceNote);
+      else if constexpr (UnmappedBeh == UnmappedNotesBehaviour::USE_AS_IS)
+        out.add(noteCodeIn);
+    }
+  }
+
+  // The dispatch table, indexed by mapping mode and unmapped notes behaviour
+  template <PatternNotesMapping::Enum MappingMode>
+  constexpr std::array<TableKernel, 4> kernelsForUnmappedBehs() {
+    return { &tableKernel<MappingMode, UnmappedNotesBehaviour::SILENCE>,
+             &tableKernel<MappingMode, UnmappedNotesBehaviour::USE_AS_IS>,
+             &tableKernel<MappingMode, UnmappedNotesBehaviour::TRANSPOSE_FROM_FIRST_DEGREE>,
+             &tableKernel<MappingMode, UnmappedNotesBehaviour::PLAY_FULL_CHORD_UP_TO_NOTE> };
+  }
+
+  constexpr std::array<std::array<TableKernel, 4>, 3> TableKernels = {
+    kernelsForUnmappedBehs<PatternNotesMapping::ALWAYS_LEAVE_UNMAPPED>(),
+    kernelsForUnmappedBehs<PatternNotesMapping::SEMITONE_TO_DEGREE>(),
+    kernelsForUnmappedBehs<PatternNotesMapping::WHITE_NOTE_TO_DEGREE>()
+  };
+
+  TableKernel getTableKernel(const MappingSettings& settings) {
+    return TableKernels[settings.mappingMode][settings.unmappedBeh];
+  }
+
+} // end namespace Mapping
+
+
+void MappingTable::update(const MappingSettings& settings, const Chord& curChord) {
+  if (mIsValid && mChord == curChord && mSettings == settings)
+    return;
+
+  if (!mIsValid || !(mSettings == settings))
+    mKernel = Mapping::getTableKernel(settings);
+  mKernel(settings, curChord, mOutputs);
+
+  mChord = curChord;
+  mSettings = settings;
+  mIsValid = true;
+}
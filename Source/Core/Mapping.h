@@ -0,0 +1,116 @@
+/*
+  ==============================================================================
+
+    Mapping.h
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include "Chord.h"
+#include "Modes.h"
+
+// Identifies a note number on some midi channel. See Mapping::getNoteOnChan
+using NoteOnChan = int;
+
+const int NumMidiChannels = 16;
+
+// For each note number on each midi channel, the set of notes it has been
+// mapped to. Slots are indexed directly by NoteOnChan, and a set of notes is
+// stored inline as a Chord, so reading or updating a mapping never hashes nor
+// allocates
+class Mappings {
+private:
+  Chord mSlots[NumMidiChannels * NumMidiNotes];
+
+public:
+  Chord& operator[](NoteOnChan noteOnChan) {
+    return mSlots[noteOnChan];
+  }
+
+  void clear() {
+    std::fill(std::begin(mSlots), std::end(mSlots), Chord());
+  }
+
+  // chan is between 1 and 16
+  void clearChannel(int chan) {
+    auto* first = mSlots + (chan - 1) * NumMidiNotes;
+    std::fill(first, first + NumMidiNotes, Chord());
+  }
+};
+
+// The parameters the mappings of pattern notes depend on
+struct MappingSettings {
+  NoteNumber referenceNote = 60;
+  PatternNotesMapping::Enum mappingMode = PatternNotesMapping::SEMITONE_TO_DEGREE;
+  PatternNotesWraparound::Enum wrapMode = PatternNotesWraparound::AFTER_ALL_CHORD_DEGREES;
+  UnmappedNotesBehaviour::Enum unmappedBeh = UnmappedNotesBehaviour::SILENCE;
+
+  bool operator==(const MappingSettings&) const = default;
+};
+
+// Functions that compute the mappings of input pattern notes. See Mapping.cpp
+namespace Mapping {
+  // Adds to thisNoteMappings the note corresponding to some degree (possibly
+  // negative or above the number of degrees) of curChord, if any
+  void mapToChordDegree(PatternNotesWraparound::Enum wrapMode,
+    const Chord& curChord,
+    int degreeNum,
+    Chord& thisNoteMappings);
+
+  // Adds to thisNoteMappings the notes some input pattern note is mapped to
+  void mapPatternNote(NoteNumber referenceNote,
+    PatternNotesMapping::Enum mappingMode,
+    PatternNotesWraparound::Enum wrapMode,
+    UnmappedNotesBehaviour::Enum unmappedBeh,
+    const Chord& curChord,
+    NoteNumber noteCodeIn,
+    Chord& thisNoteMappings);
+
+  // From the bytes of a note message
+  inline NoteOnChan getNoteOnChan(const uint8_t* data) {
+    return data[1] + (data[0] & 0x0f) * NumMidiNotes;
+  }
+
+  // Same as juce::MidiMessage::isMidiNoteBlack
+  inline bool isBlackKey(NoteNumber nn) {
+    return ((1 << (nn % 12)) & 0x054a) != 0;
+  }
+
+  // Fills outputs (one Chord per input note number) with what mapPatternNote
+  // would give for each input pattern note
+  using TableKernel = void (*)(const MappingSettings&, const Chord& curChord, Chord* outputs);
+
+  // The kernel specialised for the modes of some settings
+  TableKernel getTableKernel(const MappingSettings&);
+}
+
+// The mappings of all the possible input pattern notes, for some chord and
+// pattern parameters. As long as these do not change, mapping a note ON is
+// just a lookup in this table
+class MappingTable {
+private:
+  Chord mOutputs[NumMidiNotes];
+
+  // What mOutputs has been computed for, and the kernel for these settings
+  Chord mChord;
+  MappingSettings mSettings;
+  Mapping::TableKernel mKernel;
+  bool mIsValid;
+
+public:
+  MappingTable() : mKernel(nullptr), mIsValid(false) {
+  }
+
+  // Recomputes the table if it was computed for another chord or other
+  // parameters
+  void update(const MappingSettings& settings, const Chord& curChord);
+
+  const Chord& operator[](NoteNumber noteCodeIn) const {
+    return mOutputs[noteCodeIn];
+  }
+};
@@ -0,0 +1,58 @@
+/*
+  ==============================================================================
+
+    Modes.h
+
+  ==============================================================================
+*/
+
+#pragma once
+
+// The modes the note engine works in. The values are those of the indexes of
+// the corresponding plugin parameters (see PluginProcessor.cpp)
+
+namespace WhenNoChordNote {
+  enum Enum {
+    SILENCE = 0,
+    USE_PATTERN_AS_NOTES,
+    LATCH_LAST_CHORD
+  };
+}
+
+namespace WhenSingleChordNote {
+  enum Enum {
+    SILENCE = 0,
+    USE_PATTERN_AS_NOTES,
+    USE_AS_IS,
+    POWERCHORD,
+    TRANSPOSE_LAST_CHORD
+  };
+}
+
+namespace PatternNotesMapping {
+  enum Enum {
+    ALWAYS_LEAVE_UNMAPPED = 0,
+    SEMITONE_TO_DEGREE,
+    WHITE_NOTE_TO_DEGREE
+  };
+}
+
+namespace PatternNotesWraparound {
+  enum Enum {
+    NO_WRAPAROUND = 0,
+    AFTER_ALL_CHORD_DEGREES = 1,
+    // Values of 2 and above indicate a specific number of notes after which to
+    // wrap around (effectively discarding all the chords degrees above that
+    // number, and leaving unmapped pattern notes that are above the last degree
+    // of the chord but before the wraparound value)
+  };
+}
+
+namespace UnmappedNotesBehaviour {
+  enum Enum {
+    SILENCE = 0,
+    USE_AS_IS,
+    TRANSPOSE_FROM_FIRST_DEGREE,
+    PLAY_FULL_CHORD_UP_TO_NOTE
+  };
+}
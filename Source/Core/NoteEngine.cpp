@@ -0,0 +1,63 @@
+#include "NoteEngine.h"
+
+void NoteEngine::addChordEvents(std::span<const MidiEvent> events) {
+  for (const MidiEvent& event : events) {
+    if (event.num_bytes != 3)
+      continue;
+    uint8_t type = event.data[0] & 0xf0;
+    if (type == 0x90 && event.data[2] != 0)
+      mChords.addChordNote(event.data[1]);
+    else if (type == 0x80 || type == 0x90)
+      mChords.rmChordNote(event.data[1]);
+  }
+  mChords.updateCurrentChord(mSettings.whenNoChordNote, mSettings.whenSingleChordNote);
+}
+
+NoteEngine::MapResult NoteEngine::mapPatternEvents(std::span<const MidiEvent> in,
+  std::span<MidiEvent> out) {
+  MapResult res;
+  const ChordSnapshot& curChord = mChords.getCurrentChord();
+  // Only recomputes the mapping table if the chord or the settings changed
+  mPatterns.setChord(mSettings.mapping, curChord);
+
+  for (; res.numRead < in.size(); res.numRead++) {
+    const MidiEvent& event = in[res.numRead];
+    const uint8_t* data = event.data;
+    uint8_t type = data[0] & 0xf0;
+    size_t room = out.size() - res.numWritten;
+    auto write = [&](uint8_t status, NoteNumber nn, uint8_t velocity) {
+      out[res.numWritten++] = MidiEvent{ event.sample_position, { status, (uint8_t)nn, velocity }, 3 };
+    };
+
+    if (event.num_bytes == 3 && type == 0x90 && data[2] != 0) { // NOTE ON
+      if (curChord.shouldSilence)
+        continue;
+      NoteOnChan noteOnChan = Mapping::getNoteOnChan(data);
+      NoteNumber noteCodeIn = data[1];
+      // The previous mappings of the note are released first
+      size_t numOutputs = (size_t)mPatterns.getMappings(noteOnChan).size() +
+        (mPatterns.shouldProcess() ? (size_t)mPatterns.getTableMappings(noteCodeIn).size() : 1);
+      if (numOutputs > room)
+        break;
+      uint8_t noteOffStatus = 0x80 | (data[0] & 0x0f);
+      mPatterns.mapNoteOn(noteOnChan, noteCodeIn,
+        [&](NoteNumber nn) { write(noteOffStatus, nn, 0); },
+        [&](NoteNumber nn) { write(data[0], nn, data[2]); });
+    }
+    else if (event.num_bytes == 3 && (type == 0x80 || type == 0x90)) { // NOTE OFF
+      NoteOnChan noteOnChan = Mapping::getNoteOnChan(data);
+      if ((size_t)mPatterns.getMappings(noteOnChan).size() > room)
+        break;
+      mPatterns.mapNoteOff(noteOnChan, [&](NoteNumber nn) { write(data[0], nn, data[2]); });
+    }
+    else {
+      if (room == 0)
+        break;
+      // See Arp::runArp
+      if (event.num_bytes == 3 && type == 0xb0 && (data[1] == 123 || data[1] == 120))
+        mPatterns.clearChannel((data[0] & 0x0f) + 1);
+      out[res.numWritten++] = event;
+    }
+  }
+  return res;
+}
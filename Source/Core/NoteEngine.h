@@ -0,0 +1,80 @@
+/*
+  ==============================================================================
+
+    NoteEngine.h
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <span>
+#include "ArplignerC.h"
+#include "PatternMapper.h"
+
+// A MIDI message of at most 3 bytes (notes, controllers...) at some sample
+// position. Plain data, so that buffers of events can be exchanged with code
+// that knows nothing about JUCE. It is the very type of the C interface, so
+// that the buffers of C programs are used as they are
+using MidiEvent = ArplignerMidiEvent;
+
+// The settings of the note engine, which are those of a plugin instance that
+// don't deal with how it is hosted
+struct NoteEngineSettings {
+  WhenNoChordNote::Enum whenNoChordNote = WhenNoChordNote::LATCH_LAST_CHORD;
+  WhenSingleChordNote::Enum whenSingleChordNote = WhenSingleChordNote::TRANSPOSE_LAST_CHORD;
+  MappingSettings mapping;
+};
+
+/* Arpligner's chord tracking and pattern mapping, with no plugin around it.
+   The chord events and the pattern events are given separately: the chord
+   notes given to addChordEvents make the chord that the pattern events given
+   next to mapPatternEvents are mapped to. To follow chord changes inside a
+   block of events, the caller gives the pattern events up to the change,
+   then the chord events of the change, and so on.
+
+   Nothing is allocated after construction, and no lock is taken. */
+class NoteEngine {
+private:
+  NoteEngineSettings mSettings;
+  ChordTracker mChords;
+  PatternMapper mPatterns;
+
+public:
+  void setSettings(const NoteEngineSettings& settings) {
+    mSettings = settings;
+  }
+
+  const NoteEngineSettings& getSettings() const {
+    return mSettings;
+  }
+
+  // Note ONs and note OFFs update the held chord notes, whatever their
+  // channel. The other events are ignored
+  void addChordEvents(std::span<const MidiEvent> events);
+
+  const ChordSnapshot& getCurrentChord() const {
+    return mChords.getCurrentChord();
+  }
+
+  struct MapResult {
+    // Number of input events that were processed, and of events written to
+    // the output
+    size_t numRead = 0;
+    size_t numWritten = 0;
+  };
+
+  // Maps the pattern events of in, in order, and writes the resulting events
+  // to out, each one at the position of the event it comes from. The events
+  // that are not notes are written as they are. Stops before the first input
+  // event whose output events don't fit in out, so that the remaining ones can
+  // be given again once the output is flushed
+  MapResult mapPatternEvents(std::span<const MidiEvent> in, std::span<MidiEvent> out);
+
+  // Forgets the chord and what the pattern notes being held were mapped to
+  void reset() {
+    mChords.flush();
+    mPatterns.clear();
+  }
+};
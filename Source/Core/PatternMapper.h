@@ -0,0 +1,97 @@
+/*
+  ==============================================================================
+
+    PatternMapper.h
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "ChordTracker.h"
+#include "Mapping.h"
+
+/* Maps pattern notes to the notes of the current chord, and remembers what
+   each note being held was mapped to, so that its NOTE OFF releases the right
+   notes even if the chord changed in the meantime.
+
+   The notes to send are passed to callbacks, so that the caller decides how
+   and where the events are written. */
+class PatternMapper {
+private:
+  // On each pattern chan, to which notes has been mapped each incoming
+  // NoteNumber
+  Mappings mMappings;
+  MappingTable mTable;
+  // Whether the note ONs are mapped with mTable, or to themselves
+  bool mShouldProcess = true;
+
+public:
+  PatternMapper() {
+    mMappings.clear();
+  }
+
+  // Sets the chord the next note ONs are mapped to
+  void setChord(const MappingSettings& settings, const ChordSnapshot& chord) {
+    mShouldProcess = chord.shouldProcess;
+    if (mShouldProcess)
+      mTable.update(settings, chord.chord);
+  }
+
+  // The notes a note ON would currently be mapped to, if it was mapped with
+  // the table
+  const Chord& getTableMappings(NoteNumber noteCodeIn) const {
+    return mTable[noteCodeIn];
+  }
+
+  bool shouldProcess() const {
+    return mShouldProcess;
+  }
+
+  // The notes a note is currently mapped to
+  const Chord& getMappings(NoteOnChan noteOnChan) {
+    return mMappings[noteOnChan];
+  }
+
+  // Maps a note ON, and returns whether it was mapped to any note. If we
+  // already have mappings for this note, it means we received 2+ NOTE ONs in a
+  // row for it and no NOTE OFF, so emitNoteOff(nn) is first called for each of
+  // those mappings. Then emitNoteOn(nn) is called for each new one
+  template <typename EmitNoteOff, typename EmitNoteOn>
+  bool mapNoteOn(NoteOnChan noteOnChan, NoteNumber noteCodeIn,
+    EmitNoteOff&& emitNoteOff, EmitNoteOn&& emitNoteOn) {
+    Chord& thisNoteMappings = mMappings[noteOnChan];
+    for (NoteNumber nn : thisNoteMappings)
+      emitNoteOff(nn);
+    thisNoteMappings.clear();
+
+    if (mShouldProcess)
+      thisNoteMappings = mTable[noteCodeIn];
+    else // We map the note to itself
+      thisNoteMappings.add(noteCodeIn);
+
+    for (NoteNumber nn : thisNoteMappings)
+      emitNoteOn(nn);
+    return thisNoteMappings.size() != 0;
+  }
+
+  // Calls emitNoteOff(nn) for each note some note was mapped to, and forgets
+  // these mappings
+  template <typename EmitNoteOff>
+  void mapNoteOff(NoteOnChan noteOnChan, EmitNoteOff&& emitNoteOff) {
+    Chord& thisNoteMappings = mMappings[noteOnChan];
+    for (NoteNumber nn : thisNoteMappings)
+      emitNoteOff(nn);
+    thisNoteMappings.clear();
+  }
+
+  // When the receiver is told to stop all the notes of a channel (between 1
+  // and 16), we can forget how they were mapped
+  void clearChannel(int chan) {
+    mMappings.clearChannel(chan);
+  }
+
+  void clear() {
+    mMappings.clear();
+  }
+};
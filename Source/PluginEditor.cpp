@@ -0,0 +1,114 @@
+/*
+  ==============================================================================
+
+    PluginEditor.cpp
+
+  ==============================================================================
+*/
+
+#include "PluginEditor.h"
+
+const int StatsPanelHeight = 210;
+const int ButtonsHeight = 28;
+const int Margin = 6;
+
+ArplignerAudioProcessorEditor::ArplignerAudioProcessorEditor(ArplignerAudioProcessor& p)
+  : AudioProcessorEditor(p), mProcessor(p), mParamsEditor(p) {
+  addAndMakeVisible(mParamsEditor);
+
+  auto& recorder = mProcessor.getStatsRecorder();
+  mRecordButton.setToggleState(recorder.isEnabled(), dontSendNotification);
+  mRecordButton.onClick = [this] {
+    mProcessor.getStatsRecorder().setEnabled(mRecordButton.getToggleState());
+    updateStatsText();
+  };
+  addAndMakeVisible(mRecordButton);
+
+  mClearButton.onClick = [this] {
+    mProcessor.getStatsRecorder().clear();
+    updateStatsText();
+  };
+  addAndMakeVisible(mClearButton);
+
+  mDumpButton.onClick = [this] { dumpStats(); };
+  addAndMakeVisible(mDumpButton);
+
+  mStatsLabel.setFont(Font(Font::getDefaultMonospacedFontName(), 12.0f, Font::plain));
+  mStatsLabel.setJustificationType(Justification::topLeft);
+  addAndMakeVisible(mStatsLabel);
+
+  updateStatsText();
+  startTimerHz(4);
+
+  setSize(jmax(mParamsEditor.getWidth(), 520), mParamsEditor.getHeight() + StatsPanelHeight);
+}
+
+ArplignerAudioProcessorEditor::~ArplignerAudioProcessorEditor() {
+  stopTimer();
+}
+
+void ArplignerAudioProcessorEditor::paint(Graphics& g) {
+  g.fillAll(getLookAndFeel().findColour(ResizableWindow::backgroundColourId));
+}
+
+void ArplignerAudioProcessorEditor::resized() {
+  auto area = getLocalBounds();
+  mParamsEditor.setBounds(area.removeFromTop(mParamsEditor.getHeight()));
+
+  area.reduce(Margin, Margin);
+  auto buttons = area.removeFromTop(ButtonsHeight);
+  mRecordButton.setBounds(buttons.removeFromLeft(180));
+  mDumpButton.setBounds(buttons.removeFromRight(120));
+  buttons.removeFromRight(Margin);
+  mClearButton.setBounds(buttons.removeFromRight(70));
+  mStatsLabel.setBounds(area);
+}
+
+void ArplignerAudioProcessorEditor::timerCallback() {
+  // The status may change even when nothing is recorded
+  updateStatsText();
+}
+
+void ArplignerAudioProcessorEditor::updateStatsText() {
+  auto& recorder = mProcessor.getStatsRecorder();
+  recorder.collect();
+
+  String text;
+  auto status = mProcessor.getStatusText();
+  if (status.isNotEmpty())
+    text << status << "\n";
+  text << recorder.getNumBlocksRecorded() << " blocks recorded ("
+       << recorder.getNumBlocksDropped() << " dropped), last "
+       << recorder.getNumBlocksInHistory() << " shown\n";
+  text << String().paddedRight(' ', 22)
+       << String("min").paddedLeft(' ', 10) << String("mean").paddedLeft(' ', 10)
+       << String("p99").paddedLeft(' ', 10) << String("max").paddedLeft(' ', 10) << "\n";
+  for (int f = 0; f < BlockStatsRecorder::NumFields; f++) {
+    auto field = (BlockStatsRecorder::Field)f;
+    auto summary = recorder.getSummary(field);
+    text << BlockStatsRecorder::getFieldName(field).paddedRight(' ', 22);
+    for (double value : { summary.min, summary.mean, summary.p99, summary.max })
+      text << String(value, 2).paddedLeft(' ', 10);
+    text << "\n";
+  }
+  mStatsLabel.setText(text, dontSendNotification);
+}
+
+void ArplignerAudioProcessorEditor::dumpStats() {
+  auto defaultFile = File::getSpecialLocation(File::userDocumentsDirectory)
+    .getChildFile("ArplignerBlockStats.csv");
+  mFileChooser = std::make_unique<FileChooser>("Dump block stats", defaultFile, "*.csv");
+  auto flags = FileBrowserComponent::saveMode | FileBrowserComponent::canSelectFiles
+    | FileBrowserComponent::warnAboutOverwriting;
+
+  mFileChooser->launchAsync(flags, [this](const FileChooser& chooser) {
+    auto file = chooser.getResult();
+    if (file == File())
+      return;
+    auto& recorder = mProcessor.getStatsRecorder();
+    recorder.collect();
+    if (!recorder.dumpToFile(file))
+      AlertWindow::showMessageBoxAsync(MessageBoxIconType::WarningIcon, "Arpligner",
+        "Could not write " + file.getFullPathName());
+  });
+}
@@ -0,0 +1,42 @@
+/*
+  ==============================================================================
+
+    PluginEditor.h
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "PluginProcessor.h"
+
+using namespace juce;
+
+
+// The generic editor for all the parameters, plus a panel showing the stats of
+// the last processed blocks
+class ArplignerAudioProcessorEditor : public AudioProcessorEditor, private Timer {
+public:
+  ArplignerAudioProcessorEditor(ArplignerAudioProcessor&);
+  ~ArplignerAudioProcessorEditor() override;
+
+  void paint(Graphics&) override;
+  void resized() override;
+
+private:
+  ArplignerAudioProcessor& mProcessor;
+
+  GenericAudioProcessorEditor mParamsEditor;
+  ToggleButton mRecordButton{ "Record block stats" };
+  TextButton mClearButton{ "Clear" };
+  TextButton mDumpButton{ "Dump to file..." };
+  Label mStatsLabel;
+  std::unique_ptr<FileChooser> mFileChooser;
+
+  void timerCallback() override;
+  void updateStatsText();
+  void dumpStats();
+
+  JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ArplignerAudioProcessorEditor)
+};
@@ -11,6 +11,8 @@
 
 #include "PluginProcessor.h"
 #include "ChordStore.h"
+#include "PluginEditor.h"
+#include "RealtimeChecks.h"
 
 //==============================================================================
 ArplignerAudioProcessor::ArplignerAudioProcessor()
@@ -80,6 +82,25 @@ ArplignerAudioProcessor::ArplignerAudioProcessor()
   (unmappedNotesBehaviour = new AudioParameterChoice
   ("unmappedNotesBehaviour", "Unmapped notes behaviour", unmappedBehs,
     UnmappedNotesBehaviour::SILENCE));
+
+  addParameter
+  (eventTiming = new AudioParameterChoice
+  ("eventTiming", "Event timing",
+    StringArray{ "Per block", "Sample-accurate" },
+    EventTiming::SAMPLE_ACCURATE));
+
+  StringArray busNames;
+  for (int i = 1; i <= NumChordBuses; i++)
+    busNames.add(String("Bus ") + String(i));
+  addParameter
+  (chordBus = new AudioParameterChoice
+  ("chordBus", "Global chord bus", busNames, 0));
+
+  addParameter
+  (chordBusScope = new AudioParameterChoice
+  ("chordBusScope", "Global chord bus scope",
+    StringArray{ "This process", "All processes (shared memory)" },
+    ChordBusScope::THIS_PROCESS));
 }
 
 ArplignerAudioProcessor::~ArplignerAudioProcessor()
@@ -183,6 +204,8 @@ bool ArplignerAudioProcessor::isBusesLayoutSupported(const BusesLayout& layouts)
 void ArplignerAudioProcessor::processBlock(AudioBuffer<float>& buffer, MidiBuffer& midiMessages)
 {
   ScopedNoDenormals noDenormals;
+  // Only does something when built with ARPLIGNER_RT_CHECKS
+  RealtimeChecks::ScopedRealtimeThread realtimeThread;
   auto totalNumInputChannels = getTotalNumInputChannels();
   auto totalNumOutputChannels = getTotalNumOutputChannels();
 
@@ -195,7 +218,19 @@ void ArplignerAudioProcessor::processBlock(AudioBuffer<float>& buffer, MidiBuffe
   for (auto i = totalNumInputChannels; i < totalNumOutputChannels; ++i)
     buffer.clear(i, 0, buffer.getNumSamples());
 
+  curBlockStats = BlockStats();
+  if (!statsRecorder.isEnabled()) {
+    runArp(midiMessages);
+    return;
+  }
+
+  curBlockStats.numEventsIn = midiMessages.getNumEvents();
+  auto start = std::chrono::steady_clock::now();
   runArp(midiMessages);
+  curBlockStats.processingMicros =
+    std::chrono::duration<float, std::micro>(std::chrono::steady_clock::now() - start).count();
+  curBlockStats.numEventsOut = midiMessages.getNumEvents();
+  statsRecorder.push(curBlockStats);
 }
 
 //==============================================================================
@@ -206,7 +241,7 @@ bool ArplignerAudioProcessor::hasEditor() const
 
 AudioProcessorEditor* ArplignerAudioProcessor::createEditor()
 {
-  return new GenericAudioProcessorEditor(*this);
+  return new ArplignerAudioProcessorEditor(*this);
 }
 
 // Save state info
@@ -221,6 +256,9 @@ void ArplignerAudioProcessor::getStateInformation(MemoryBlock& destData)
   s.writeInt(*numMillisecsOfLatency);
   s.writeInt(*patternNotesWraparound);
   s.writeInt(*unmappedNotesBehaviour);
+  s.writeInt(*eventTiming);
+  s.writeInt(*chordBus);
+  s.writeInt(*chordBusScope);
 }
 
 // Reload state info
@@ -235,4 +273,10 @@ void ArplignerAudioProcessor::setStateInformation(const void* data, int sizeInBy
   *numMillisecsOfLatency = s.readInt();
   *patternNotesWraparound = s.readInt();
   *unmappedNotesBehaviour = s.readInt();
+  // States saved by older versions end here, in which case readInt returns 0
+  // and we keep the per-block behaviour they were using
+  *eventTiming = s.readInt();
+  // Older states had only one global chord store, which is now bus 1
+  *chordBus = s.readInt();
+  *chordBusScope = s.readInt();
 }
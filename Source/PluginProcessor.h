@@ -9,6 +9,8 @@
 #pragma once
 
 #include <JuceHeader.h>
+#include "BlockStats.h"
+#include "Core/Modes.h"
 
 using namespace juce;
 
@@ -60,6 +62,18 @@ public:
   void getStateInformation(MemoryBlock& destData) override;
   void setStateInformation(const void* data, int sizeInBytes) override;
 
+  //==============================================================================
+  // Per-block instrumentation, only recording when enabled (from the editor)
+  BlockStatsRecorder& getStatsRecorder() {
+    return statsRecorder;
+  }
+
+  // Something the user should know about the way the instance currently
+  // works, shown by the editor, or an empty string. Message thread only
+  virtual String getStatusText() const {
+    return {};
+  }
+
 protected:
   AudioParameterChoice* instanceBehaviour;
   AudioParameterChoice* whenNoChordNote;
@@ -69,8 +83,16 @@ protected:
   AudioParameterInt* numMillisecsOfLatency;
   AudioParameterChoice* patternNotesWraparound;
   AudioParameterChoice* unmappedNotesBehaviour;
+  AudioParameterChoice* eventTiming;
+  AudioParameterChoice* chordBus;
+  AudioParameterChoice* chordBusScope;
+
+  // Reset before each call to runArp, which fills in what it knows about
+  BlockStats curBlockStats;
 
 private:
+  BlockStatsRecorder statsRecorder;
+
   //==============================================================================
   JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ArplignerAudioProcessor)
 };
@@ -87,48 +109,23 @@ namespace InstanceBehaviour {
   };
 }
 
-namespace WhenNoChordNote {
-  enum Enum {
-    SILENCE = 0,
-    USE_PATTERN_AS_NOTES,
-    LATCH_LAST_CHORD
-  };
-}
-
-namespace WhenSingleChordNote {
-  enum Enum {
-    SILENCE = 0,
-    USE_PATTERN_AS_NOTES,
-    USE_AS_IS,
-    POWERCHORD,
-    TRANSPOSE_LAST_CHORD
-  };
-}
-
-namespace PatternNotesMapping {
-  enum Enum {
-    ALWAYS_LEAVE_UNMAPPED = 0,
-    SEMITONE_TO_DEGREE,
-    WHITE_NOTE_TO_DEGREE
-  };
-}
-
-namespace PatternNotesWraparound {
+namespace ChordBusScope {
   enum Enum {
-    NO_WRAPAROUND = 0,
-    AFTER_ALL_CHORD_DEGREES = 1,
-    // Values of 2 and above indicate a specific number of notes after which to
-    // wrap around (effectively discarding all the chords degrees above that
-    // number, and leaving unmapped pattern notes that are above the last degree
-    // of the chord but before the wraparound value)
+    // Only the instances of the same process share the chord buses
+    THIS_PROCESS = 0,
+    // The chord buses are in shared memory, for hosts running each plugin in
+    // its own process
+    ALL_PROCESSES
   };
 }
 
-namespace UnmappedNotesBehaviour {
+namespace EventTiming {
   enum Enum {
-    SILENCE = 0,
-    USE_AS_IS,
-    TRANSPOSE_FROM_FIRST_DEGREE,
-    PLAY_FULL_CHORD_UP_TO_NOTE
+    // All the events of a buffer are processed together and sent at the
+    // beginning of the buffer (behaviour of older versions)
+    PER_BLOCK = 0,
+    // Events are processed in timestamp order and keep their original position
+    // in the buffer
+    SAMPLE_ACCURATE
   };
 }
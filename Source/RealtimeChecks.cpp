@@ -0,0 +1,414 @@
+/*
+  ==============================================================================
+
+    RealtimeChecks.cpp
+
+  ==============================================================================
+*/
+
+// The fortified versions of read & co are inline functions, which the
+// definitions below would clash with
+#undef _FORTIFY_SOURCE
+
+#include "RealtimeChecks.h"
+
+#if ARPLIGNER_RT_CHECKS && defined(__linux__) && defined(__GLIBC__)
+
+#include <atomic>
+#include <cerrno>
+#include <cstdarg>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/select.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace RealtimeChecks {
+
+  // Initial-exec, so that reading them never allocates, even in a plugin
+  // loaded with dlopen
+  static thread_local int realtimeDepth __attribute__((tls_model("initial-exec"))) = 0;
+  // Set while a violation is being reported, which itself allocates and writes
+  static thread_local bool isReporting __attribute__((tls_model("initial-exec"))) = false;
+
+  static std::atomic<int64_t> numViolations{ 0 };
+  static std::atomic<bool> abortOnViolation{ false };
+
+  // The hashes of the call stacks already reported, so that a call made at
+  // each block is only reported once. Once full, everything is reported
+  const int NumCallStackSlots = 1024;
+  static std::atomic<uint64_t> reportedCallStacks[NumCallStackSlots];
+
+  const int MaxFrames = 64;
+
+  static bool isChecking() {
+    return realtimeDepth > 0 && !isReporting;
+  }
+
+  // Returns whether the call stack was not reported yet
+  static bool rememberCallStack(void* const* frames, int numFrames) {
+    uint64_t hash = 14695981039346656037ull;
+    for (int i = 0; i < numFrames; i++)
+      hash = (hash ^ (uint64_t)(uintptr_t)frames[i]) * 1099511628211ull;
+    if (hash == 0)
+      hash = 1;
+    for (int i = 0; i < NumCallStackSlots; i++) {
+      auto& slot = reportedCallStacks[(hash + (uint64_t)i) % NumCallStackSlots];
+      uint64_t expected = 0;
+      if (slot.compare_exchange_strong(expected, hash, std::memory_order_relaxed))
+        return true;
+      if (expected == hash)
+        return false;
+    }
+    return true;
+  }
+
+  static void writeToStderr(const char* text) {
+    ssize_t res = ::write(STDERR_FILENO, text, strlen(text));
+    (void)res;
+  }
+
+  // Called by each function below when the thread is being checked, before
+  // doing anything else
+  static void reportViolation(const char* function) {
+    numViolations.fetch_add(1, std::memory_order_relaxed);
+    isReporting = true;
+
+    void* frames[MaxFrames];
+    // Skips this function, so that the stack starts at the offending call
+    int numFrames = backtrace(frames, MaxFrames) - 1;
+    bool shouldAbort = abortOnViolation.load(std::memory_order_relaxed);
+    if (rememberCallStack(frames + 1, numFrames) || shouldAbort) {
+      writeToStderr("Arpligner: real-time violation in processBlock: ");
+      writeToStderr(function);
+      writeToStderr("\n");
+      backtrace_symbols_fd(frames + 1, numFrames, STDERR_FILENO);
+    }
+    if (shouldAbort)
+      abort();
+
+    isReporting = false;
+  }
+
+  // A function taken over below, as found after this file in the symbol
+  // lookup order (i.e. the one from glibc)
+  template <typename Fn>
+  struct NextFunction {
+    const char* name;
+    std::atomic<Fn> fn{ nullptr };
+
+    Fn get() {
+      Fn res = fn.load(std::memory_order_relaxed);
+      if (res == nullptr) {
+        res = (Fn)dlsym(RTLD_NEXT, name);
+        fn.store(res, std::memory_order_relaxed);
+      }
+      return res;
+    }
+  };
+
+  static NextFunction<int (*)(pthread_mutex_t*)> nextMutexLock{ "pthread_mutex_lock" };
+  static NextFunction<int (*)(pthread_rwlock_t*)> nextRwlockRdlock{ "pthread_rwlock_rdlock" };
+  static NextFunction<int (*)(pthread_rwlock_t*)> nextRwlockWrlock{ "pthread_rwlock_wrlock" };
+  static NextFunction<int (*)(pthread_cond_t*, pthread_mutex_t*)> nextCondWait{ "pthread_cond_wait" };
+  static NextFunction<int (*)(pthread_cond_t*, pthread_mutex_t*, const timespec*)> nextCondTimedwait{ "pthread_cond_timedwait" };
+  static NextFunction<int (*)(pthread_t, void**)> nextJoin{ "pthread_join" };
+  static NextFunction<int (*)(sem_t*)> nextSemWait{ "sem_wait" };
+  static NextFunction<int (*)(sem_t*, const timespec*)> nextSemTimedwait{ "sem_timedwait" };
+  static NextFunction<int (*)(const timespec*, timespec*)> nextNanosleep{ "nanosleep" };
+  static NextFunction<int (*)(clockid_t, int, const timespec*, timespec*)> nextClockNanosleep{ "clock_nanosleep" };
+  static NextFunction<int (*)(useconds_t)> nextUsleep{ "usleep" };
+  static NextFunction<unsigned int (*)(unsigned int)> nextSleep{ "sleep" };
+  static NextFunction<ssize_t (*)(int, void*, size_t)> nextRead{ "read" };
+  static NextFunction<ssize_t (*)(int, const void*, size_t)> nextWrite{ "write" };
+  static NextFunction<int (*)(const char*, int, ...)> nextOpen{ "open" };
+  static NextFunction<int (*)(pollfd*, nfds_t, int)> nextPoll{ "poll" };
+  static NextFunction<int (*)(int, fd_set*, fd_set*, fd_set*, timeval*)> nextSelect{ "select" };
+
+  // Looks everything up while the library is loaded, as dlsym and the first
+  // call to backtrace allocate
+  static const bool isInitialised = [] {
+    nextMutexLock.get(); nextRwlockRdlock.get(); nextRwlockWrlock.get();
+    nextCondWait.get(); nextCondTimedwait.get(); nextJoin.get();
+    nextSemWait.get(); nextSemTimedwait.get();
+    nextNanosleep.get(); nextClockNanosleep.get(); nextUsleep.get(); nextSleep.get();
+    nextRead.get(); nextWrite.get(); nextOpen.get(); nextPoll.get(); nextSelect.get();
+
+    void* frames[MaxFrames];
+    backtrace(frames, MaxFrames);
+
+    const char* env = getenv("ARPLIGNER_RT_CHECKS");
+    abortOnViolation.store(env != nullptr && strcmp(env, "abort") == 0);
+    return true;
+  }();
+
+  bool isAvailable() {
+    return true;
+  }
+
+  int64_t getNumViolations() {
+    return numViolations.load(std::memory_order_relaxed);
+  }
+
+  void setAbortOnViolation(bool shouldAbort) {
+    abortOnViolation.store(shouldAbort);
+  }
+
+  ScopedRealtimeThread::ScopedRealtimeThread() {
+    realtimeDepth++;
+  }
+
+  ScopedRealtimeThread::~ScopedRealtimeThread() {
+    realtimeDepth--;
+  }
+
+} // end namespace RealtimeChecks
+
+using RealtimeChecks::isChecking;
+using RealtimeChecks::reportViolation;
+
+#if defined(__PIC__) && !defined(__PIE__)
+// Built into a shared library (the plugin formats): exported, the functions
+// below would only come after glibc's in the symbol lookup order, as the host
+// loaded glibc first. Hidden, they are at least what the plugin's own calls
+// bind to. GCC ignores visibility attributes on functions the system headers
+// already declared, hence the assembler directives
+__asm__(".hidden malloc\n\t.hidden calloc\n\t.hidden realloc\n\t.hidden aligned_alloc\n\t"
+        ".hidden posix_memalign\n\t.hidden free\n\t"
+        ".hidden pthread_mutex_lock\n\t.hidden pthread_rwlock_rdlock\n\t.hidden pthread_rwlock_wrlock\n\t"
+        ".hidden pthread_cond_wait\n\t.hidden pthread_cond_timedwait\n\t.hidden pthread_join\n\t"
+        ".hidden sem_wait\n\t.hidden sem_timedwait\n\t.hidden nanosleep\n\t.hidden clock_nanosleep\n\t"
+        ".hidden usleep\n\t.hidden sleep\n\t.hidden read\n\t.hidden write\n\t.hidden open\n\t"
+        ".hidden poll\n\t.hidden select\n\t"
+        // operator new and delete, mangled
+        ".hidden _Znwm\n\t.hidden _Znam\n\t.hidden _ZnwmRKSt9nothrow_t\n\t.hidden _ZnamRKSt9nothrow_t\n\t"
+        ".hidden _ZdlPv\n\t.hidden _ZdaPv\n\t.hidden _ZdlPvm\n\t.hidden _ZdaPvm");
+#endif
+
+// glibc exports its allocator under these names too, as AllocationCounter.cpp
+// also relies on
+extern "C" {
+  void* __libc_malloc(size_t);
+  void* __libc_calloc(size_t, size_t);
+  void* __libc_realloc(void*, size_t);
+  void* __libc_memalign(size_t, size_t);
+  void __libc_free(void*);
+
+  void* malloc(size_t size) {
+    if (isChecking())
+      reportViolation("malloc");
+    return __libc_malloc(size);
+  }
+
+  void* calloc(size_t num, size_t size) {
+    if (isChecking())
+      reportViolation("calloc");
+    return __libc_calloc(num, size);
+  }
+
+  void* realloc(void* ptr, size_t size) {
+    if (isChecking())
+      reportViolation("realloc");
+    return __libc_realloc(ptr, size);
+  }
+
+  void* aligned_alloc(size_t alignment, size_t size) {
+    if (isChecking())
+      reportViolation("aligned_alloc");
+    return __libc_memalign(alignment, size);
+  }
+
+  int posix_memalign(void** ptr, size_t alignment, size_t size) {
+    if (isChecking())
+      reportViolation("posix_memalign");
+    if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0)
+      return EINVAL;
+    void* res = __libc_memalign(alignment, size);
+    if (res == nullptr)
+      return ENOMEM;
+    *ptr = res;
+    return 0;
+  }
+
+  void free(void* ptr) {
+    if (ptr != nullptr && isChecking())
+      reportViolation("free");
+    __libc_free(ptr);
+  }
+
+  int pthread_mutex_lock(pthread_mutex_t* mutex) noexcept {
+    if (isChecking())
+      reportViolation("pthread_mutex_lock");
+    return RealtimeChecks::nextMutexLock.get()(mutex);
+  }
+
+  int pthread_rwlock_rdlock(pthread_rwlock_t* rwlock) noexcept {
+    if (isChecking())
+      reportViolation("pthread_rwlock_rdlock");
+    return RealtimeChecks::nextRwlockRdlock.get()(rwlock);
+  }
+
+  int pthread_rwlock_wrlock(pthread_rwlock_t* rwlock) noexcept {
+    if (isChecking())
+      reportViolation("pthread_rwlock_wrlock");
+    return RealtimeChecks::nextRwlockWrlock.get()(rwlock);
+  }
+
+  int pthread_cond_wait(pthread_cond_t* cond, pthread_mutex_t* mutex) {
+    if (isChecking())
+      reportViolation("pthread_cond_wait");
+    return RealtimeChecks::nextCondWait.get()(cond, mutex);
+  }
+
+  int pthread_cond_timedwait(pthread_cond_t* cond, pthread_mutex_t* mutex, const struct timespec* abstime) {
+    if (isChecking())
+      reportViolation("pthread_cond_timedwait");
+    return RealtimeChecks::nextCondTimedwait.get()(cond, mutex, abstime);
+  }
+
+  int pthread_join(pthread_t thread, void** result) {
+    if (isChecking())
+      reportViolation("pthread_join");
+    return RealtimeChecks::nextJoin.get()(thread, result);
+  }
+
+  int sem_wait(sem_t* sem) {
+    if (isChecking())
+      reportViolation("sem_wait");
+    return RealtimeChecks::nextSemWait.get()(sem);
+  }
+
+  int sem_timedwait(sem_t* sem, const struct timespec* abstime) {
+    if (isChecking())
+      reportViolation("sem_timedwait");
+    return RealtimeChecks::nextSemTimedwait.get()(sem, abstime);
+  }
+
+  int nanosleep(const struct timespec* duration, struct timespec* remaining) {
+    if (isChecking())
+      reportViolation("nanosleep");
+    return RealtimeChecks::nextNanosleep.get()(duration, remaining);
+  }
+
+  int clock_nanosleep(clockid_t clock, int flags, const struct timespec* request, struct timespec* remaining) {
+    if (isChecking())
+      reportViolation("clock_nanosleep");
+    return RealtimeChecks::nextClockNanosleep.get()(clock, flags, request, remaining);
+  }
+
+  int usleep(useconds_t duration) {
+    if (isChecking())
+      reportViolation("usleep");
+    return RealtimeChecks::nextUsleep.get()(duration);
+  }
+
+  unsigned int sleep(unsigned int seconds) {
+    if (isChecking())
+      reportViolation("sleep");
+    return RealtimeChecks::nextSleep.get()(seconds);
+  }
+
+  ssize_t read(int fd, void* buf, size_t count) {
+    if (isChecking())
+      reportViolation("read");
+    return RealtimeChecks::nextRead.get()(fd, buf, count);
+  }
+
+  ssize_t write(int fd, const void* buf, size_t count) {
+    if (isChecking())
+      reportViolation("write");
+    return RealtimeChecks::nextWrite.get()(fd, buf, count);
+  }
+
+  int open(const char* path, int flags, ...) {
+    if (isChecking())
+      reportViolation("open");
+    mode_t mode = 0;
+    if ((flags & O_CREAT) != 0 || (flags & O_TMPFILE) == O_TMPFILE) {
+      va_list args;
+      va_start(args, flags);
+      mode = va_arg(args, mode_t);
+      va_end(args);
+    }
+    return RealtimeChecks::nextOpen.get()(path, flags, mode);
+  }
+
+  int poll(struct pollfd* fds, nfds_t numFds, int timeout) {
+    if (isChecking())
+      reportViolation("poll");
+    return RealtimeChecks::nextPoll.get()(fds, numFds, timeout);
+  }
+
+  int select(int numFds, fd_set* readFds, fd_set* writeFds, fd_set* exceptFds, struct timeval* timeout) {
+    if (isChecking())
+      reportViolation("select");
+    return RealtimeChecks::nextSelect.get()(numFds, readFds, writeFds, exceptFds, timeout);
+  }
+}
+
+// operator new and delete go through malloc and free. They are replaced too,
+// for the plugin's own calls to end up in the functions above even when they
+// are not exported (the plugin formats hide all their symbols)
+void* operator new(std::size_t size) {
+  if (void* res = malloc(size != 0 ? size : 1))
+    return res;
+  throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+  return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+  return malloc(size != 0 ? size : 1);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+  return malloc(size != 0 ? size : 1);
+}
+
+void operator delete(void* ptr) noexcept {
+  free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+  free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+  free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept {
+  free(ptr);
+}
+
+#else
+
+bool RealtimeChecks::isAvailable() {
+  return false;
+}
+
+int64_t RealtimeChecks::getNumViolations() {
+  return 0;
+}
+
+void RealtimeChecks::setAbortOnViolation(bool) {
+}
+
+#if ARPLIGNER_RT_CHECKS
+RealtimeChecks::ScopedRealtimeThread::ScopedRealtimeThread() {
+}
+
+RealtimeChecks::ScopedRealtimeThread::~ScopedRealtimeThread() {
+}
+#endif
+
+#endif
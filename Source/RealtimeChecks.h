@@ -0,0 +1,52 @@
+/*
+  ==============================================================================
+
+    RealtimeChecks.h
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <cstdint>
+
+#ifndef ARPLIGNER_RT_CHECKS
+  #define ARPLIGNER_RT_CHECKS 0
+#endif
+
+/* A debugging aid for the audio path. Built with ARPLIGNER_RT_CHECKS=1, the
+   plugin watches what the audio thread does during processBlock, and reports
+   every call that may block it: heap allocations and deallocations, mutex,
+   read/write lock, semaphore and condition variable waits, sleeps and file
+   I/O. The call stack of each offending call is printed to stderr, once per
+   call stack. If the ARPLIGNER_RT_CHECKS environment variable is "abort", the
+   process aborts on the first one instead.
+
+   This is only implemented on Linux (with glibc), where the functions
+   involved are taken over by RealtimeChecks.cpp. Everywhere else, and when
+   built without ARPLIGNER_RT_CHECKS, nothing is checked. */
+namespace RealtimeChecks {
+  // Whether calls are checked in this build
+  bool isAvailable();
+
+  // Number of offending calls made so far, on all the threads
+  int64_t getNumViolations();
+
+  void setAbortOnViolation(bool shouldAbort);
+
+  // The calls the current thread makes are checked as long as it is in such
+  // a scope
+  class ScopedRealtimeThread {
+  public:
+#if ARPLIGNER_RT_CHECKS
+    ScopedRealtimeThread();
+    ~ScopedRealtimeThread();
+#else
+    ScopedRealtimeThread() {
+    }
+#endif
+
+    ScopedRealtimeThread(const ScopedRealtimeThread&) = delete;
+    ScopedRealtimeThread& operator=(const ScopedRealtimeThread&) = delete;
+  };
+}
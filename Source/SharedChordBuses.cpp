@@ -0,0 +1,151 @@
+#include "SharedChordBuses.h"
+
+#if JUCE_LINUX || JUCE_BSD || JUCE_MAC
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define ARPLIGNER_HAS_SHARED_MEMORY 1
+#else
+#define ARPLIGNER_HAS_SHARED_MEMORY 0
+#endif
+
+// To be bumped whenever the layout of Segment (ChordTimeline and ChordSnapshot
+// included) changes, so that different versions of the plugin never share a
+// segment
+static const int SegmentLayoutVersion = 3;
+
+// How long the segment may stay uninitialised before we assume its creator
+// died, and remove it
+static const uint32 MaxInitWaitMs = 1000;
+
+// When the attempts to open the segment (which are never made concurrently,
+// see ChordBuses::openSharedBuses) started finding it uninitialised. open()
+// doesn't wait for the creator, so the wait is measured across attempts
+static bool gIsWaitingForInit = false;
+static uint32 gWaitingForInitSinceMs = 0;
+
+// Returns whether the segment has been found uninitialised for too long
+static bool hasWaitedTooLongForInit() {
+  auto now = Time::getMillisecondCounter();
+  if (!gIsWaitingForInit) {
+    gIsWaitingForInit = true;
+    gWaitingForInitSinceMs = now;
+  }
+  if (now - gWaitingForInitSinceMs < MaxInitWaitMs)
+    return false;
+  gIsWaitingForInit = false;
+  return true;
+}
+
+struct SharedChordBuses::Segment {
+  enum State : uint32 {
+    // A freshly created segment is filled with zeros
+    UNINITIALISED = 0,
+    READY
+  };
+
+  std::atomic<uint32> state;
+  uint32 size;
+  ChordTimeline timelines[NumChordBuses];
+};
+
+SharedChordBuses::SharedChordBuses(Segment* segment, size_t mappedSize)
+  : mSegment(segment), mMappedSize(mappedSize) {
+  // A process that dies while holding the writer lock of a bus never
+  // releases it
+  for (auto& timeline : mSegment->timelines)
+    mBuses.add(new GlobalChordStore(timeline, true));
+}
+
+String SharedChordBuses::getSegmentName() {
+  // macOS limits the names to 31 characters
+#if ARPLIGNER_HAS_SHARED_MEMORY
+  return "/arpligner-v" + String(SegmentLayoutVersion) + "-" + String((int64)getuid());
+#else
+  return {};
+#endif
+}
+
+#if ARPLIGNER_HAS_SHARED_MEMORY
+
+SharedChordBuses::~SharedChordBuses() {
+  mBuses.clear();
+  munmap(mSegment, mMappedSize);
+}
+
+std::unique_ptr<SharedChordBuses> SharedChordBuses::open() {
+  auto name = getSegmentName();
+  const size_t size = sizeof(Segment);
+
+  // Only the process that creates the segment initialises it
+  bool isCreator = true;
+  int fd = shm_open(name.toRawUTF8(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0 && errno == EEXIST) {
+    isCreator = false;
+    fd = shm_open(name.toRawUTF8(), O_RDWR, 0600);
+  }
+  if (fd < 0)
+    return nullptr;
+
+  if (isCreator) {
+    if (ftruncate(fd, (off_t)size) != 0) {
+      close(fd);
+      shm_unlink(name.toRawUTF8());
+      return nullptr;
+    }
+  }
+  else {
+    // The creator may not have set the size yet
+    struct stat st {};
+    if (fstat(fd, &st) != 0 || st.st_size != (off_t)size) {
+      close(fd);
+      // It probably died before setting it. Nobody can be using the segment,
+      // so it is removed for the next attempt to start afresh
+      if (st.st_size == 0 && hasWaitedTooLongForInit())
+        shm_unlink(name.toRawUTF8());
+      return nullptr;
+    }
+  }
+
+  void* mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED)
+    return nullptr;
+
+  // The zeros of a new segment are a valid (uninitialised) state
+  auto* segment = static_cast<Segment*>(mapped);
+  if (isCreator) {
+    for (auto& timeline : segment->timelines)
+      new (&timeline) ChordTimeline();
+    segment->size = (uint32)size;
+    segment->state.store(Segment::READY, std::memory_order_release);
+  }
+  else {
+    if (segment->state.load(std::memory_order_acquire) != Segment::READY) {
+      munmap(mapped, size);
+      // Same as above, if the creator never finishes initialising it
+      if (hasWaitedTooLongForInit())
+        shm_unlink(name.toRawUTF8());
+      return nullptr;
+    }
+    if (segment->size != size) {
+      munmap(mapped, size);
+      return nullptr;
+    }
+  }
+
+  gIsWaitingForInit = false;
+  return std::unique_ptr<SharedChordBuses>(new SharedChordBuses(segment, size));
+}
+
+#else
+
+SharedChordBuses::~SharedChordBuses() {
+}
+
+std::unique_ptr<SharedChordBuses> SharedChordBuses::open() {
+  return nullptr;
+}
+
+#endif
@@ -0,0 +1,51 @@
+/*
+  ==============================================================================
+
+    SharedChordBuses.h
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "ChordStore.h"
+
+/* The chord buses shared by all the processes of the current user, for hosts
+   that run each plugin in its own process. Their timelines live in a POSIX
+   shared memory segment, and each process has its own GlobalChordStores on
+   top of them. Publishing and reading chords is then exactly the same as with
+   the buses of a single process: no system call is made on the audio path.
+
+   The segment is created by the first process that opens it, and is never
+   removed (it is small, and another process may still be using it). It is not
+   available on Windows. */
+class SharedChordBuses {
+private:
+  struct Segment;
+
+  Segment* mSegment;
+  size_t mMappedSize;
+  OwnedArray<GlobalChordStore> mBuses;
+
+  SharedChordBuses(Segment*, size_t mappedSize);
+
+public:
+  ~SharedChordBuses();
+
+  // Maps the segment, creating and initialising it if no other process did.
+  // Returns nullptr if shared memory is not available, or if another process
+  // is still initialising the segment (this doesn't wait for it: the caller
+  // tries again later). Makes system calls, so this must not be called from
+  // the audio thread
+  static std::unique_ptr<SharedChordBuses> open();
+
+  // The name of the segment, different for each user
+  static String getSegmentName();
+
+  // bus is between 0 and NumChordBuses - 1
+  GlobalChordStore& getBus(int bus) {
+    return *mBuses.getUnchecked(bus);
+  }
+
+  JUCE_DECLARE_NON_COPYABLE(SharedChordBuses)
+};
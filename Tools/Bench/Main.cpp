@@ -0,0 +1,392 @@
+/*
+  ==============================================================================
+
+    Main.cpp
+
+    ArplignerBench: microbenchmarks of the note path (pattern note mappings and
+    chord updates)
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "Arp.h"
+#include "Core/Kernels.h"
+#include "Core/NoteEngine.h"
+#include "../Common/ToolUtils.h"
+#include "../Common/AllocationCounter.h"
+
+
+static const char* const Usage =
+  "Usage: ArplignerBench [--events N] [--filter TEXT]\n"
+  "\n"
+  "  --events N     Number of events each benchmark processes (default: 1000000)\n"
+  "  --filter TEXT  Only runs the benchmarks whose name contains TEXT\n";
+
+// Each benchmark is timed that many times, and the fastest run is kept, which
+// is the least disturbed by the rest of the system
+const int NumRuns = 5;
+
+// Keeps the compiler from optimizing away the results of the benchmarked code
+static volatile int sink;
+
+
+struct Measurement {
+  double nsPerEvent;
+  double allocsPerEvent;
+};
+
+// runEvents(n) processes n events
+template <typename Fn>
+static Measurement measure(int64 numEvents, Fn&& runEvents) {
+  runEvents(jmax((int64)1, numEvents / 10));
+
+  Measurement res{ std::numeric_limits<double>::max(), 0 };
+  for (int run = 0; run < NumRuns; run++) {
+    int64 allocsBefore = AllocationCounter::getNumAllocations();
+    auto start = std::chrono::steady_clock::now();
+    runEvents(numEvents);
+    auto end = std::chrono::steady_clock::now();
+    int64 allocs = AllocationCounter::getNumAllocations() - allocsBefore;
+
+    double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    res.nsPerEvent = jmin(res.nsPerEvent, ns / numEvents);
+    res.allocsPerEvent = jmax(res.allocsPerEvent, (double)allocs / numEvents);
+  }
+  return res;
+}
+
+
+class Bench {
+private:
+  int64 mNumEvents;
+  String mFilter;
+
+public:
+  Bench(int64 numEvents, const String& filter) : mNumEvents(numEvents), mFilter(filter) {
+    std::printf("%-80s %10s %14s\n", "Benchmark", "ns/event", "allocs/event");
+  }
+
+  template <typename Fn>
+  void run(const String& name, Fn&& runEvents) {
+    if (mFilter.isNotEmpty() && !name.contains(mFilter))
+      return;
+    Measurement res = measure(mNumEvents, runEvents);
+    std::printf("%-80s %10.2f %14.4f\n", name.toRawUTF8(), res.nsPerEvent, res.allocsPerEvent);
+    std::fflush(stdout);
+  }
+};
+
+
+static Chord makeChord(std::initializer_list<NoteNumber> notes) {
+  Chord chord;
+  for (auto nn : notes)
+    chord.add(nn);
+  return chord;
+}
+
+// The wraparound modes that are benchmarked. Values of 2 and above all go
+// through the same code, so two of them (below and above the number of chord
+// degrees) are enough
+static const std::pair<int, const char*> WrapModes[] = {
+  { PatternNotesWraparound::NO_WRAPAROUND, "none" },
+  { PatternNotesWraparound::AFTER_ALL_CHORD_DEGREES, "after-all" },
+  { 3, "3" },
+  { 12, "12" }
+};
+
+static const std::pair<int, const char*> MappingModes[] = {
+  { PatternNotesMapping::ALWAYS_LEAVE_UNMAPPED, "unmapped" },
+  { PatternNotesMapping::SEMITONE_TO_DEGREE, "semitone" },
+  { PatternNotesMapping::WHITE_NOTE_TO_DEGREE, "white-note" }
+};
+
+static const std::pair<int, const char*> UnmappedBehaviours[] = {
+  { UnmappedNotesBehaviour::SILENCE, "silence" },
+  { UnmappedNotesBehaviour::USE_AS_IS, "as-is" },
+  { UnmappedNotesBehaviour::TRANSPOSE_FROM_FIRST_DEGREE, "transpose" },
+  { UnmappedNotesBehaviour::PLAY_FULL_CHORD_UP_TO_NOTE, "full-chord" }
+};
+
+static void benchMapToChordDegree(Bench& bench) {
+  // A 5-note chord, with degrees going from 3 octaves below to 3 octaves above
+  const Chord chord = makeChord({ 48, 52, 55, 59, 62 });
+  for (auto [wrapMode, wrapName] : WrapModes) {
+    bench.run(String("Mapping::mapToChordDegree wrap=") + wrapName, [&](int64 n) {
+      Chord out;
+      for (int64 i = 0; i < n; i++) {
+        out.clear();
+        Mapping::mapToChordDegree((PatternNotesWraparound::Enum)wrapMode, chord, (int)(i % 31) - 15, out);
+        sink = out.size();
+      }
+    });
+  }
+}
+
+static void benchMapPatternNote(Bench& bench) {
+  // Every input note is mapped in turn, so all the branches get exercised
+  const Chord chord = makeChord({ 48, 52, 55, 59, 62 });
+  for (auto [mappingMode, mappingName] : MappingModes) {
+    for (auto [wrapMode, wrapName] : WrapModes) {
+      for (auto [unmappedBeh, unmappedName] : UnmappedBehaviours) {
+        String name = String("Mapping::mapPatternNote mapping=") + mappingName +
+          " wrap=" + wrapName + " unmapped=" + unmappedName;
+        bench.run(name, [&](int64 n) {
+          Chord out;
+          for (int64 i = 0; i < n; i++) {
+            out.clear();
+            Mapping::mapPatternNote(60,
+              (PatternNotesMapping::Enum)mappingMode,
+              (PatternNotesWraparound::Enum)wrapMode,
+              (UnmappedNotesBehaviour::Enum)unmappedBeh,
+              chord,
+              (NoteNumber)(i % NumMidiNotes),
+              out);
+            sink = out.size();
+          }
+        });
+      }
+    }
+  }
+}
+
+// Each event maps one input note, as part of the computation of a whole
+// MappingTable (all 128 input notes) for a new chord. "generic" is the
+// switch-based path (mapPatternNote for each note), "kernel" the specialised
+// table kernel selected for the modes
+static void benchMappingTable(Bench& bench) {
+  // Two chords, so that each table is computed for another chord than the
+  // previous one
+  const Chord chords[2] = { makeChord({ 48, 52, 55, 59, 62 }), makeChord({ 50, 53, 57, 60 }) };
+  for (auto [mappingMode, mappingName] : MappingModes) {
+    for (auto [wrapMode, wrapName] : WrapModes) {
+      for (auto [unmappedBeh, unmappedName] : UnmappedBehaviours) {
+        MappingSettings settings{ 60,
+          (PatternNotesMapping::Enum)mappingMode,
+          (PatternNotesWraparound::Enum)wrapMode,
+          (UnmappedNotesBehaviour::Enum)unmappedBeh };
+        String modes = String(" mapping=") + mappingName + " wrap=" + wrapName + " unmapped=" + unmappedName;
+
+        bench.run("MappingTable fill=generic" + modes, [&](int64 n) {
+          Chord outputs[NumMidiNotes];
+          for (int64 i = 0; i < n; i += NumMidiNotes) {
+            const Chord& chord = chords[(i / NumMidiNotes) & 1];
+            for (NoteNumber nn = 0; nn < NumMidiNotes; nn++) {
+              outputs[nn].clear();
+              Mapping::mapPatternNote(settings.referenceNote, settings.mappingMode, settings.wrapMode,
+                settings.unmappedBeh, chord, nn, outputs[nn]);
+            }
+            sink = outputs[i % NumMidiNotes].size();
+          }
+        });
+
+        bench.run("MappingTable fill=kernel " + modes, [&](int64 n) {
+          Chord outputs[NumMidiNotes];
+          for (int64 i = 0; i < n; i += NumMidiNotes) {
+            Mapping::getTableKernel(settings)(settings, chords[(i / NumMidiNotes) & 1], outputs);
+            sink = outputs[i % NumMidiNotes].size();
+          }
+        });
+      }
+    }
+  }
+}
+
+// The kernels of each instruction set the CPU supports, whatever
+// ARPLIGNER_KERNELS selects. Each event maps one input note, or checks one
+// counter when building the held notes
+static void benchKernels(Bench& bench) {
+  const Chord chords[2] = { makeChord({ 48, 52, 55, 59, 62 }), makeChord({ 50, 53, 57, 60 }) };
+  uint8_t counts[2][NumMidiNotes] = {};
+  Kernels::DegreeParams params[2] = {};
+  for (int c = 0; c < 2; c++) {
+    for (NoteNumber nn : chords[c]) {
+      counts[c][nn] = 1;
+      params[c].degrees[params[c].numChordDegrees++] = (uint8_t)nn;
+    }
+    params[c].referenceNote = 60;
+  }
+
+  for (int set = 0; set < Kernels::NumInstructionSets; set++) {
+    auto* kernels = Kernels::get((Kernels::InstructionSet)set);
+    if (kernels == nullptr)
+      continue;
+    String isa = String(" isa=") + kernels->name;
+
+    for (bool whiteKeysOnly : { false, true }) {
+      for (auto [wrapMode, wrapName] : WrapModes) {
+        for (auto& p : params) {
+          p.whiteKeysOnly = whiteKeysOnly;
+          p.numValidDegrees = wrapMode == PatternNotesWraparound::NO_WRAPAROUND ? Kernels::NoWraparound
+            : wrapMode == PatternNotesWraparound::AFTER_ALL_CHORD_DEGREES ? p.numChordDegrees
+            : wrapMode;
+        }
+        String name = "Kernels::mapDegrees" + isa + " mapping=" + (whiteKeysOnly ? "white-note" : "semitone") +
+          " wrap=" + wrapName;
+        bench.run(name, [&](int64 n) {
+          int8_t notes[NumMidiNotes];
+          for (int64 i = 0; i < n; i += NumMidiNotes) {
+            kernels->mapDegrees(params[(i / NumMidiNotes) & 1], notes);
+            sink = notes[i % NumMidiNotes];
+          }
+        });
+      }
+    }
+
+    bench.run("Kernels::heldNotes" + isa, [&](int64 n) {
+      for (int64 i = 0; i < n; i += NumMidiNotes)
+        sink = kernels->heldNotes(counts[(i / NumMidiNotes) & 1]).size();
+    });
+  }
+}
+
+// Each event changes one note of a chord of numNotes notes (so the chord
+// always has to be updated), then updates the current chord
+static void benchUpdateCurrentChord(Bench& bench, const String& storeName, ChordStore& store) {
+  for (int numNotes = 1; numNotes <= 32; numNotes++) {
+    bench.run("ChordStore::updateCurrentChord store=" + storeName + " notes=" + String(numNotes), [&](int64 n) {
+      store.flushCurrentChord();
+      for (int k = 0; k < numNotes; k++)
+        store.addChordNote(24 + 3 * k);
+      store.updateCurrentChord(WhenNoChordNote::LATCH_LAST_CHORD, WhenSingleChordNote::USE_AS_IS, 0);
+      // Alternates between the lowest note and the note just above it
+      NoteNumber cur = 24;
+      ChordSnapshot snapshot;
+      for (int64 i = 0; i < n; i++) {
+        NoteNumber next = (cur == 24) ? 25 : 24;
+        store.rmChordNote(cur);
+        store.addChordNote(next);
+        cur = next;
+        store.updateCurrentChord(WhenNoChordNote::LATCH_LAST_CHORD, WhenSingleChordNote::USE_AS_IS, i);
+      }
+      store.getChordAt(n - 1, snapshot);
+      sink = snapshot.chord.size();
+    });
+  }
+}
+
+// Ratcheted pattern notes on channel 1 of a multi-channel instance (chords
+// are on channel 16). Either each one is mapped to one degree of the chord, or
+// left unmapped and played as all the degrees of the chord up to it (chord
+// stabs)
+static void benchMultiChanBlocks(Bench& bench, int blockSize, const String& name,
+  PatternNotesMapping::Enum mappingMode) {
+  for (int numNotes : { 8, 32 }) {
+    std::unique_ptr<AudioProcessor> processor(createPluginFilter());
+    setParameter(*processor, "chordChan", 16);
+    setParameter(*processor, "patternNotesMapping", mappingMode);
+    setParameter(*processor, "unmappedNotesBehaviour", UnmappedNotesBehaviour::PLAY_FULL_CHORD_UP_TO_NOTE);
+    processor->prepareToPlay(44100, blockSize);
+    AudioBuffer<float> audio(0, blockSize);
+    MidiBuffer midi, input;
+    midi.ensureSize(16384);
+    for (int nn : { 48, 52, 55, 59, 62 })
+      midi.addEvent(MidiMessage::noteOn(16, nn, (uint8)100), 0);
+    processor->processBlock(audio, midi);
+    for (int k = 0; k < numNotes; k++) {
+      input.addEvent(MidiMessage::noteOn(1, 56 + k % 12, (uint8)100), 2 * k * blockSize / (2 * numNotes));
+      input.addEvent(MidiMessage::noteOff(1, 56 + k % 12), (2 * k + 1) * blockSize / (2 * numNotes));
+    }
+
+    bench.run("Arp::processBlock instance=multi-chan " + name + "=" + String(numNotes), [&](int64 n) {
+      for (int64 i = 0; i < n; i++) {
+        // MidiBuffer::addEvents would be much slower than what is measured
+        midi.data.clearQuick();
+        midi.data.addArray(input.data);
+        processor->processBlock(audio, midi);
+        sink = midi.getNumEvents();
+      }
+    });
+    processor->releaseResources();
+  }
+}
+
+// Each event is a whole block of 64 samples processed by a pattern instance
+// (following global chord bus 1), so that the constant overhead of each block
+// shows up. The incoming pattern notes are all NOTE ONs followed by their NOTE
+// OFFs in the same block
+static void benchProcessBlock(Bench& bench) {
+  const int blockSize = 64;
+  for (int numNotes : { 0, 1, 8 }) {
+    std::unique_ptr<AudioProcessor> processor(createPluginFilter());
+    setParameter(*processor, "chordChan", InstanceBehaviour::IS_PATTERN);
+    processor->prepareToPlay(44100, blockSize);
+    AudioBuffer<float> audio(0, blockSize);
+    MidiBuffer midi, input;
+    midi.ensureSize(4096);
+    for (int k = 0; k < numNotes; k++) {
+      input.addEvent(MidiMessage::noteOn(1, 60 + k, (uint8)100), 2 * k);
+      input.addEvent(MidiMessage::noteOff(1, 60 + k), 2 * k + 1);
+    }
+
+    bench.run("Arp::processBlock instance=pattern notes-per-block=" + String(numNotes), [&](int64 n) {
+      for (int64 i = 0; i < n; i++) {
+        // MidiBuffer::addEvents would be much slower than what is measured
+        midi.data.clearQuick();
+        midi.data.addArray(input.data);
+        processor->processBlock(audio, midi);
+        sink = midi.getNumEvents();
+      }
+    });
+    processor->releaseResources();
+  }
+
+  benchMultiChanBlocks(bench, blockSize, "mapped-notes-per-block", PatternNotesMapping::SEMITONE_TO_DEGREE);
+  benchMultiChanBlocks(bench, blockSize, "chord-stabs-per-block", PatternNotesMapping::ALWAYS_LEAVE_UNMAPPED);
+}
+
+// The blocks of benchMultiChanBlocks (mapped notes), given directly to the
+// JUCE-free NoteEngine, without any plugin around it
+static void benchNoteEngine(Bench& bench) {
+  const int blockSize = 64;
+  for (int numNotes : { 8, 32 }) {
+    NoteEngine engine;
+    std::vector<MidiEvent> chord, input, output(16 * numNotes);
+    for (int nn : { 48, 52, 55, 59, 62 })
+      chord.push_back({ 0, { 0x9f, (uint8)nn, 100 }, 3 });
+    engine.addChordEvents(chord);
+    for (int k = 0; k < numNotes; k++) {
+      uint8 nn = (uint8)(56 + k % 12);
+      input.push_back({ 2 * k * blockSize / (2 * numNotes), { 0x90, nn, 100 }, 3 });
+      input.push_back({ (2 * k + 1) * blockSize / (2 * numNotes), { 0x80, nn, 0 }, 3 });
+    }
+
+    bench.run("NoteEngine::mapPatternEvents mapped-notes-per-block=" + String(numNotes), [&](int64 n) {
+      for (int64 i = 0; i < n; i++)
+        sink = (int)engine.mapPatternEvents(input, output).numWritten;
+    });
+  }
+}
+
+static int runBenchmarks(const ArgumentList& args) {
+  if (args.containsOption("--help|-h")) {
+    std::cout << Usage;
+    return 0;
+  }
+
+  int numEvents = intOptionValue(args, "--events", 1000000, 1, std::numeric_limits<int>::max());
+  String filter = args.containsOption("--filter") ? optionValue(args, "--filter") : String();
+
+  if (!AllocationCounter::isAvailable())
+    std::cout << "(allocations are not counted on this platform)" << std::endl;
+
+  Bench bench(numEvents, filter);
+  benchMapToChordDegree(bench);
+  benchMapPatternNote(bench);
+  benchMappingTable(bench);
+  benchKernels(bench);
+
+  ChordStore localStore;
+  benchUpdateCurrentChord(bench, "local", localStore);
+  benchUpdateCurrentChord(bench, "global", ChordBuses::getInstance()->getBus(0));
+  benchProcessBlock(bench);
+  benchNoteEngine(bench);
+  ChordBuses::deleteInstance();
+  return 0;
+}
+
+int main(int argc, char* argv[]) {
+  ScopedJuceInitialiser_GUI juceInit;
+  ArgumentList args(argc, argv);
+  return ConsoleApplication::invokeCatchingFailures([&] { return runBenchmarks(args); });
+}
@@ -0,0 +1,130 @@
+/*
+  ==============================================================================
+
+    Main.c
+
+    ArplignerCApiTest: a C99 program using the whole C interface of the note
+    engine (see ../Source/Core/ArplignerC.h). Being built with -pedantic
+    checks that the header is plain C, and running it checks that the
+    interface works from C
+
+  ==============================================================================
+*/
+
+#include <stdio.h>
+#include "ArplignerC.h"
+
+static int numFailures = 0;
+
+static void check(int condition, const char* description) {
+  if (!condition) {
+    printf("FAILED: %s\n", description);
+    numFailures++;
+  }
+}
+
+static ArplignerMidiEvent noteEvent(int32_t pos, uint8_t status, uint8_t nn, uint8_t vel) {
+  ArplignerMidiEvent event;
+  event.sample_position = pos;
+  event.data[0] = status;
+  event.data[1] = nn;
+  event.data[2] = vel;
+  event.num_bytes = 3;
+  return event;
+}
+
+/* Maps one pattern note ON, then its note OFF, and returns the note it was
+   mapped to, or -1 if it wasn't mapped to exactly one note */
+static int mapOneNote(ArplignerEngine* engine, uint8_t nn) {
+  ArplignerMidiEvent input[2], output[8];
+  size_t numRead = 0, numWritten = 0;
+  int mapped;
+  input[0] = noteEvent(10, 0x91, nn, 100);
+  input[1] = noteEvent(20, 0x81, nn, 0);
+
+  arpligner_engine_map_pattern_events(engine, input, 1, output, 8, &numRead, &numWritten);
+  if (numRead != 1 || numWritten != 1 || output[0].data[0] != 0x91 || output[0].sample_position != 10)
+    return -1;
+  mapped = output[0].data[1];
+
+  /* The note OFF must release the note the note ON was mapped to */
+  arpligner_engine_map_pattern_events(engine, input + 1, 1, output, 8, &numRead, &numWritten);
+  if (numRead != 1 || numWritten != 1 || output[0].data[0] != 0x81 || output[0].data[1] != mapped ||
+    output[0].sample_position != 20)
+    return -1;
+  return mapped;
+}
+
+int main(void) {
+  ArplignerSettings settings;
+  ArplignerEngine* engine;
+  ArplignerMidiEvent chord[3], input[2], output[4];
+  size_t numRead = 0, numWritten = 0;
+
+  check(arpligner_api_version() == ARPLIGNER_API_VERSION, "the library was built with another version of the header");
+
+  engine = arpligner_engine_create();
+  if (engine == NULL) {
+    printf("FAILED: could not create an engine\n");
+    return 1;
+  }
+
+  arpligner_default_settings(&settings);
+  check(settings.pattern_notes_mapping == ARPLIGNER_PATTERN_NOTES_MAPPING_SEMITONE_TO_DEGREE &&
+    settings.pattern_notes_wraparound == ARPLIGNER_PATTERN_NOTES_WRAPAROUND_AFTER_ALL_CHORD_DEGREES,
+    "unexpected default settings");
+  settings.reference_note = 60;
+  check(arpligner_engine_set_settings(engine, &settings) == 0, "valid settings rejected");
+  settings.reference_note = 128;
+  check(arpligner_engine_set_settings(engine, &settings) == -1, "out-of-range reference note accepted");
+  settings.reference_note = 60;
+
+  /* C major, as 48 52 55 */
+  chord[0] = noteEvent(0, 0x9f, 48, 100);
+  chord[1] = noteEvent(0, 0x9f, 52, 100);
+  chord[2] = noteEvent(0, 0x9f, 55, 100);
+  arpligner_engine_add_chord_events(engine, chord, 3);
+
+  /* Each semitone above the reference note is the next degree, wrapping
+     around one octave up after the 3 degrees of the chord */
+  check(mapOneNote(engine, 60) == 48, "note 60 not mapped to the first degree");
+  check(mapOneNote(engine, 61) == 52, "note 61 not mapped to the second degree");
+  check(mapOneNote(engine, 62) == 55, "note 62 not mapped to the third degree");
+  check(mapOneNote(engine, 63) == 60, "note 63 not mapped to the first degree, one octave up");
+  check(mapOneNote(engine, 59) == 43, "note 59 not mapped to the third degree, one octave down");
+
+  /* The events that are not notes are passed through */
+  input[0].sample_position = 5;
+  input[0].data[0] = 0xb1;
+  input[0].data[1] = 1;
+  input[0].data[2] = 64;
+  input[0].num_bytes = 3;
+  arpligner_engine_map_pattern_events(engine, input, 1, output, 4, &numRead, &numWritten);
+  check(numRead == 1 && numWritten == 1 && output[0].data[0] == 0xb1 && output[0].data[2] == 64,
+    "controller not passed through");
+
+  /* Nothing is read when the output is full */
+  input[0] = noteEvent(0, 0x90, 60, 100);
+  arpligner_engine_map_pattern_events(engine, input, 1, output, 0, &numRead, &numWritten);
+  check(numRead == 0 && numWritten == 0, "event read without room for its output");
+
+  /* Releasing a chord note changes the chord. After a reset, there is no
+     chord anymore, so the pattern notes are silenced */
+  chord[0].data[0] = 0x8f;
+  arpligner_engine_add_chord_events(engine, chord, 1);
+  check(mapOneNote(engine, 60) == 52, "note 60 not mapped to the first degree of the new chord");
+  arpligner_engine_reset(engine);
+  settings.when_no_chord_note = ARPLIGNER_WHEN_NO_CHORD_NOTE_SILENCE;
+  check(arpligner_engine_set_settings(engine, &settings) == 0, "valid settings rejected");
+  input[0] = noteEvent(0, 0x90, 60, 100);
+  arpligner_engine_map_pattern_events(engine, input, 1, output, 4, &numRead, &numWritten);
+  check(numRead == 1 && numWritten == 0, "pattern note not silenced after a reset");
+
+  arpligner_engine_destroy(engine);
+  arpligner_engine_destroy(NULL);
+
+  if (numFailures > 0)
+    return 1;
+  printf("All checks of the C interface passed\n");
+  return 0;
+}
@@ -0,0 +1,67 @@
+/*
+  ==============================================================================
+
+    AllocationCounter.cpp
+
+  ==============================================================================
+*/
+
+#include "AllocationCounter.h"
+
+#include <cstddef>
+
+#include "RealtimeChecks.h"
+
+// With ARPLIGNER_RT_CHECKS, RealtimeChecks.cpp takes over malloc & co instead
+#if defined(__linux__) && defined(__GLIBC__) && !ARPLIGNER_RT_CHECKS
+
+static thread_local int64_t numAllocations = 0;
+
+// glibc exports its allocator under these names too, so the functions below
+// can take over the public names and forward to them. operator new ends up in
+// malloc as well, as do JUCE's HeapBlocks
+extern "C" {
+  void* __libc_malloc(size_t);
+  void* __libc_calloc(size_t, size_t);
+  void* __libc_realloc(void*, size_t);
+  void __libc_free(void*);
+
+  void* malloc(size_t size) {
+    numAllocations++;
+    return __libc_malloc(size);
+  }
+
+  void* calloc(size_t num, size_t size) {
+    numAllocations++;
+    return __libc_calloc(num, size);
+  }
+
+  void* realloc(void* ptr, size_t size) {
+    numAllocations++;
+    return __libc_realloc(ptr, size);
+  }
+
+  void free(void* ptr) {
+    __libc_free(ptr);
+  }
+}
+
+bool AllocationCounter::isAvailable() {
+  return true;
+}
+
+int64_t AllocationCounter::getNumAllocations() {
+  return numAllocations;
+}
+
+#else
+
+bool AllocationCounter::isAvailable() {
+  return false;
+}
+
+int64_t AllocationCounter::getNumAllocations() {
+  return 0;
+}
+
+#endif
@@ -0,0 +1,23 @@
+/*
+  ==============================================================================
+
+    AllocationCounter.h
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <cstdint>
+
+// Counts the heap allocations made by each thread, to check that some piece of
+// code does not allocate. Only available on Linux, where the tools linking
+// AllocationCounter.cpp replace malloc & co, and not in the builds with
+// ARPLIGNER_RT_CHECKS (see RealtimeChecks.h). Elsewhere, counts stay at 0
+namespace AllocationCounter {
+  bool isAvailable();
+
+  // Number of calls to malloc, calloc and realloc made by the calling thread
+  // since it started
+  int64_t getNumAllocations();
+}
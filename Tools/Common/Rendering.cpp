@@ -0,0 +1,152 @@
+/*
+  ==============================================================================
+
+    Rendering.cpp
+
+  ==============================================================================
+*/
+
+#include "Rendering.h"
+#include "PluginProcessor.h"
+#include "ToolUtils.h"
+
+
+// One Arpligner instance, with the events it receives and sends, timestamped
+// in samples
+struct Instance {
+  // Like a host compensating the latency of the instance, we give it its input
+  // that many samples early
+  int latency = 0;
+  std::unique_ptr<AudioProcessor> processor;
+  MidiMessageSequence input;
+  MidiMessageSequence output;
+  int nextInputEvent = 0;
+};
+
+
+Array<MidiMessageSequence> renderTracks(const RenderSettings& settings, int blockSize, RenderStats& stats) {
+  // Building the instances. They all follow the same playhead, so in
+  // multi-instance mode, the pattern instances get the chord changes at their
+  // exact position on the timeline. The chord instance still comes first
+  // (unless chordInstanceLast), so that even without latency, the chord
+  // changes of a block are published before the pattern instances process
+  // that same block
+  bool multiChannel = settings.multiChannel;
+  ToolPlayHead playHead;
+  std::vector<Instance> instances(multiChannel ? 1 : settings.patternEvents.size() + 1);
+  for (auto& inst : instances) {
+    inst.processor.reset(createPluginFilter());
+    inst.processor->setPlayHead(&playHead);
+  }
+
+  if (multiChannel) {
+    for (auto* holder : settings.chordEvents) {
+      auto msg = holder->message;
+      if (msg.getChannel() > 0)
+        msg.setChannel(settings.chordChannel);
+      instances[0].input.addEvent(msg);
+    }
+    for (auto& events : settings.patternEvents)
+      instances[0].input.addSequence(events, 0);
+    instances[0].input.sort();
+  }
+  else {
+    instances[0].input = settings.chordEvents;
+    for (int i = 0; i < settings.patternEvents.size(); i++)
+      instances[i + 1].input = settings.patternEvents[i];
+  }
+
+  for (size_t i = 0; i < instances.size(); i++) {
+    auto& processor = *instances[i].processor;
+    for (auto& [paramID, value] : settings.params)
+      setParameter(processor, paramID, value);
+    int behaviour = multiChannel ? settings.chordChannel
+                                 : i == 0 ? InstanceBehaviour::IS_CHORD : InstanceBehaviour::IS_PATTERN;
+    setParameter(processor, "chordChan", behaviour);
+    processor.prepareToPlay(settings.sampleRate, blockSize);
+    instances[i].latency = processor.getLatencySamples();
+  }
+
+  int64 numSamples = 0;
+  int maxLatency = 0;
+  for (auto& inst : instances) {
+    if (inst.input.getNumEvents() > 0)
+      numSamples = jmax(numSamples, (int64)inst.input.getEndTime() + 1);
+    maxLatency = jmax(maxLatency, inst.latency);
+  }
+
+  AudioBuffer<float> audio(0, blockSize);
+  MidiBuffer midi;
+  stats = RenderStats();
+  auto startTime = Time::getHighResolutionTicks();
+
+  // Like a host, we start playing early enough for the instances with some
+  // latency to get the events at the very beginning
+  for (int64 blockStart = -maxLatency; blockStart < numSamples; blockStart += blockSize) {
+    stats.numBlocks++;
+    playHead.setTimeInSamples(blockStart);
+    for (size_t i = 0; i < instances.size(); i++) {
+      auto& inst = instances[settings.chordInstanceLast ? (i + 1) % instances.size() : i];
+      midi.clear();
+      int64 inputStart = blockStart + inst.latency;
+      for (; inst.nextInputEvent < inst.input.getNumEvents(); inst.nextInputEvent++) {
+        auto& msg = inst.input.getEventPointer(inst.nextInputEvent)->message;
+        if (msg.getTimeStamp() >= inputStart + blockSize)
+          break;
+        midi.addEvent(msg, (int)(msg.getTimeStamp() - inputStart));
+        stats.numEventsIn++;
+      }
+      inst.processor->processBlock(audio, midi);
+      // Only the chord instance has some latency, and its output is not
+      // rendered, so the output doesn't need to be shifted back
+      for (auto msgMD : midi) {
+        auto msg = msgMD.getMessage();
+        msg.setTimeStamp((double)(blockStart + msgMD.samplePosition));
+        inst.output.addEvent(msg);
+      }
+    }
+  }
+
+  stats.elapsedSeconds = Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - startTime);
+
+  for (auto& inst : instances)
+    inst.processor->releaseResources();
+
+  Array<MidiMessageSequence> tracks;
+  for (size_t i = multiChannel ? 0 : 1; i < instances.size(); i++)
+    tracks.add(instances[i].output);
+  return tracks;
+}
+
+static String describeEvent(const MidiMessageSequence& events, int i) {
+  if (i >= events.getNumEvents())
+    return "nothing";
+  auto& msg = events.getEventPointer(i)->message;
+  return String::toHexString(msg.getRawData(), msg.getRawDataSize()) + " at " + String((int64)msg.getTimeStamp());
+}
+
+String findFirstDifference(const MidiMessageSequence& expected, const MidiMessageSequence& actual) {
+  int numEvents = jmax(expected.getNumEvents(), actual.getNumEvents());
+  for (int i = 0; i < numEvents; i++) {
+    if (i < expected.getNumEvents() && i < actual.getNumEvents()) {
+      auto& a = expected.getEventPointer(i)->message;
+      auto& b = actual.getEventPointer(i)->message;
+      if (a.getTimeStamp() == b.getTimeStamp() && a.getRawDataSize() == b.getRawDataSize() &&
+        memcmp(a.getRawData(), b.getRawData(), (size_t)a.getRawDataSize()) == 0)
+        continue;
+    }
+    return "event " + String(i) + ": expected " + describeEvent(expected, i) + ", got " + describeEvent(actual, i);
+  }
+  return {};
+}
+
+String findFirstDifference(const Array<MidiMessageSequence>& expected, const Array<MidiMessageSequence>& actual) {
+  if (expected.size() != actual.size())
+    return "expected " + String(expected.size()) + " tracks, got " + String(actual.size());
+  for (int t = 0; t < expected.size(); t++) {
+    auto difference = findFirstDifference(expected[t], actual[t]);
+    if (difference.isNotEmpty())
+      return "track " + String(t + 1) + ", " + difference;
+  }
+  return {};
+}
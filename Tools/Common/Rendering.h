@@ -0,0 +1,55 @@
+/*
+  ==============================================================================
+
+    Rendering.h
+
+    Offline rendering of MIDI sequences through Arpligner instances, the same
+    way a host would run them in real time. Shared by ArplignerRender and
+    ArplignerTest
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+using namespace juce;
+
+// The block sizes the output must not depend on, with sample-accurate event
+// timing
+const int BlockSizesToCheck[] = { 1, 2, 3, 7, 16, 64, 100, 128, 256, 480, 512, 1000, 1024, 2048, 4096 };
+
+// Everything that is rendered
+struct RenderSettings {
+  bool multiChannel = false;
+  int chordChannel = 16;
+  double sampleRate = 44100;
+  // In multi-instance mode, runs the chord instance after the pattern
+  // instances in each block instead of before them, as hosts may run the
+  // instances in any order
+  bool chordInstanceLast = false;
+  Array<std::pair<String, int>> params;
+  // Timestamped in samples
+  MidiMessageSequence chordEvents;
+  Array<MidiMessageSequence> patternEvents;
+};
+
+struct RenderStats {
+  int64 numEventsIn = 0;
+  int numBlocks = 0;
+  double elapsedSeconds = 0;
+};
+
+// Runs the instances over all the events with blocks of blockSize samples.
+// Returns the events sent by each rendered instance (in multi-instance mode,
+// the output of the chord instance is just its input, so it is not rendered),
+// timestamped in samples
+Array<MidiMessageSequence> renderTracks(const RenderSettings& settings, int blockSize, RenderStats& stats);
+
+// The first difference between two tracks, or an empty string if they contain
+// exactly the same events, in the same order
+String findFirstDifference(const MidiMessageSequence& expected, const MidiMessageSequence& actual);
+
+// Same, for all the tracks of two renderings
+String findFirstDifference(const Array<MidiMessageSequence>& expected, const Array<MidiMessageSequence>& actual);
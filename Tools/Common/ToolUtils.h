@@ -0,0 +1,111 @@
+/*
+  ==============================================================================
+
+    ToolUtils.h
+
+    Helpers shared by the command-line tools
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+using namespace juce;
+
+AudioProcessor* JUCE_CALLTYPE createPluginFilter();
+
+
+inline void fail(const String& message) {
+  ConsoleApplication::fail("Error: " + message);
+}
+
+inline RangedAudioParameter* findParameter(AudioProcessor& processor, const String& paramID) {
+  for (auto* param : processor.getParameters())
+    if (auto* ranged = dynamic_cast<RangedAudioParameter*>(param))
+      if (ranged->paramID == paramID)
+        return ranged;
+  return nullptr;
+}
+
+inline void setParameter(AudioProcessor& processor, const String& paramID, int value) {
+  auto* param = findParameter(processor, paramID);
+  if (param == nullptr)
+    fail("Unknown parameter '" + paramID + "'. Use --list-params to see the valid ones");
+  auto range = param->getNormalisableRange();
+  if (value < range.start || value > range.end)
+    fail("Value " + String(value) + " out of range for parameter '" + paramID + "'");
+  param->setValueNotifyingHost(param->convertTo0to1((float)value));
+}
+
+// ArgumentList only understands "--opt=value" for long options, so option
+// values are read by position instead, which also works for options that can
+// be repeated. Accepts both "--opt value" and "--opt=value", and moves i past
+// the value
+inline String optionValueAt(const ArgumentList& args, int& i) {
+  auto value = args[i].getLongOptionValue();
+  if (value.isEmpty() && i + 1 < args.size() && !args[i + 1].isOption())
+    value = args[++i].text;
+  if (value.isEmpty())
+    fail("Missing value for " + args[i].text.upToFirstOccurrenceOf("=", false, false));
+  return value.unquoted();
+}
+
+inline String optionValue(const ArgumentList& args, StringRef option, const String& defaultValue = {}) {
+  int i = args.indexOfOption(option);
+  if (i < 0) {
+    if (defaultValue.isEmpty())
+      fail("Missing " + option + " option");
+    return defaultValue;
+  }
+  return optionValueAt(args, i);
+}
+
+inline File existingFile(const String& path) {
+  File file = File::getCurrentWorkingDirectory().getChildFile(path);
+  if (!file.existsAsFile())
+    fail("File doesn't exist: " + file.getFullPathName());
+  return file;
+}
+
+inline int intOptionValue(const ArgumentList& args, StringRef option, int defaultValue, int minValue, int maxValue) {
+  auto str = optionValue(args, option, String(defaultValue));
+  if (str.isEmpty() || !str.containsOnly("0123456789") || str.getIntValue() < minValue || str.getIntValue() > maxValue)
+    fail("Invalid value '" + str + "' for " + option);
+  return str.getIntValue();
+}
+
+// A playing transport, whose position is set by the tool before each block
+class ToolPlayHead : public AudioPlayHead {
+private:
+  // May be read by the audio threads while being set for the next block
+  std::atomic<int64> mTimeInSamples{ 0 };
+
+public:
+  void setTimeInSamples(int64 timeInSamples) {
+    mTimeInSamples = timeInSamples;
+  }
+
+  Optional<PositionInfo> getPosition() const override {
+    PositionInfo info;
+    info.setIsPlaying(true);
+    info.setTimeInSamples(mTimeInSamples.load());
+    return info;
+  }
+};
+
+// The values of all the --param ID=VALUE options
+inline Array<std::pair<String, int>> parameterOptions(const ArgumentList& args) {
+  Array<std::pair<String, int>> params;
+  for (int i = 0; i < args.size(); i++) {
+    if (args[i].isLongOption("param")) {
+      auto value = optionValueAt(args, i);
+      if (!value.containsChar('='))
+        fail("--param expects ID=VALUE, got '" + value + "'");
+      params.add({ value.upToFirstOccurrenceOf("=", false, false),
+                   value.fromFirstOccurrenceOf("=", false, false).getIntValue() });
+    }
+  }
+  return params;
+}
@@ -0,0 +1,648 @@
+/*
+  ==============================================================================
+
+    Main.cpp
+
+    ArplignerFuzz: plays random streams of chord and pattern events through
+    Arpligner, with random block sizes and parameter changes, and checks that
+    no note is left hanging and that the audio path does not allocate. Also
+    checks that the kernels of every instruction set the CPU supports give
+    exactly the same results as the scalar ones, that pattern instances keep
+    the held chord when the host jumps back on its timeline, and that pattern
+    notes turned off and on again in the same group of events stay held
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "Arp.h"
+#include "Core/Kernels.h"
+#include "Core/Mapping.h"
+#include "../Common/ToolUtils.h"
+#include "../Common/AllocationCounter.h"
+#include "RealtimeChecks.h"
+
+
+static const char* const Usage =
+  "Usage: ArplignerFuzz [--runs N] [--seed N] [--max-length N]\n"
+  "       ArplignerFuzz FILE...\n"
+  "\n"
+  "  --runs N          Number of random inputs to try (default: 10000)\n"
+  "  --seed N          Seed of the first input (default: random). Input i uses\n"
+  "                    seed N + i, so that a failure can be reproduced alone\n"
+  "  --max-length N    Maximum size of the inputs, in bytes (default: 4096)\n"
+  "  FILE...           Replays these inputs (e.g. one saved after a failure)\n"
+  "\n"
+  "When a check fails, the input is saved to arpligner-fuzz-failure.bin.\n"
+  "Built with FUZZER=libfuzzer (and clang), the program is a libFuzzer target\n"
+  "instead, taking libFuzzer's options.\n";
+
+// Maximum number of input events in a block. Arp only promises not to
+// allocate as long as the events of a block fit its scratch storage
+const int MaxEventsPerBlock = 32;
+
+// The parameters that are changed while notes are playing. They may change
+// how the next notes are mapped, but must never leave notes hanging. The
+// instance behaviour, chord bus and lookahead are only set at the start
+const char* const FuzzedParameters[] = {
+  "whenNoChordNote", "whenSingleChordNote", "firstDegreeCode", "patternNotesMapping",
+  "patternNotesWraparound", "unmappedNotesBehaviour", "eventTiming"
+};
+
+
+// A check that failed
+struct InvariantViolation {
+  String description;
+};
+
+static void check(bool condition, const String& description) {
+  if (!condition)
+    throw InvariantViolation{ description };
+}
+
+
+// Reads the input as a stream of small integers. Once it is exhausted, only
+// zeros are read, so that any input is a valid scenario
+class InputReader {
+private:
+  const uint8* mData;
+  size_t mSize;
+  size_t mPos = 0;
+
+public:
+  InputReader(const uint8* data, size_t size) : mData(data), mSize(size) {
+  }
+
+  bool isExhausted() const {
+    return mPos >= mSize;
+  }
+
+  // Between 0 and numValues - 1
+  int next(int numValues) {
+    int value = 0;
+    for (int range = 1; range < numValues && mPos < mSize; range *= 256)
+      value = value * 256 + mData[mPos++];
+    return value % numValues;
+  }
+};
+
+
+// What the instance under test sent: for each note on each channel, how many
+// NOTE ONs are not matched by a NOTE OFF yet. Two input notes can be mapped to
+// the same note, so that count can go above 1
+class OutputNotes {
+private:
+  int mCounts[NumMidiChannels][NumMidiNotes] = {};
+
+public:
+  // Checks the events sent for a block
+  void checkBlock(const MidiBuffer& midi, int blockSize) {
+    int lastPos = 0;
+    for (auto msgMD : midi) {
+      check(msgMD.samplePosition >= 0 && msgMD.samplePosition < blockSize,
+        "event sent at position " + String(msgMD.samplePosition) + " of a block of " + String(blockSize));
+      check(msgMD.samplePosition >= lastPos, "events sent out of order");
+      lastPos = msgMD.samplePosition;
+
+      if (msgMD.numBytes != 3)
+        continue;
+      auto msg = msgMD.getMessage();
+      int& count = mCounts[msg.getChannel() - 1][msg.getNoteNumber()];
+      if (msg.isNoteOn())
+        count++;
+      else if (msg.isNoteOff()) {
+        check(count > 0, "NOTE OFF sent for " + describe(msg) + ", which is not playing");
+        count--;
+      }
+      else if (msg.isAllNotesOff() || msg.isAllSoundOff())
+        std::fill(std::begin(mCounts[msg.getChannel() - 1]), std::end(mCounts[msg.getChannel() - 1]), 0);
+    }
+  }
+
+  // Once all the input notes have been released
+  void checkAllReleased() const {
+    for (int chan = 0; chan < NumMidiChannels; chan++)
+      for (int nn = 0; nn < NumMidiNotes; nn++)
+        check(mCounts[chan][nn] == 0,
+          "stuck note: " + describe(MidiMessage::noteOn(chan + 1, nn, (uint8)1)) +
+          " still playing after all the input notes were released");
+  }
+
+  static String describe(const MidiMessage& msg) {
+    return "note " + String(msg.getNoteNumber()) + " on channel " + String(msg.getChannel());
+  }
+};
+
+
+// Plays the scenario an input describes. In Multi-channel mode, a single
+// instance gets everything. In Multi-instance mode, a chord instance gets the
+// chord notes, and the pattern instance under test the rest
+class Scenario {
+private:
+  InputReader mInput;
+  ToolPlayHead mPlayHead;
+  std::unique_ptr<AudioProcessor> mChordInstance, mInstance;
+  int mChordChannel = 0;
+  int mMaxBlockSize = 0;
+  int64 mBlockStart = 0;
+
+  MidiBuffer mChordMidi, mMidi;
+  // The pattern notes currently held in the input, released at the end
+  bool mHeld[NumMidiChannels][NumMidiNotes] = {};
+  OutputNotes mOutput;
+
+  bool isMultiChannel() const {
+    return mChordChannel != 0;
+  }
+
+  void setParameterEverywhere(const String& paramID, int value) {
+    setParameter(*mInstance, paramID, value);
+    if (mChordInstance)
+      setParameter(*mChordInstance, paramID, value);
+  }
+
+  void changeParameter() {
+    auto paramID = FuzzedParameters[mInput.next(numElementsInArray(FuzzedParameters))];
+    auto* param = findParameter(*mInstance, paramID);
+    int numValues = (int)param->getNormalisableRange().end + 1;
+    setParameterEverywhere(paramID, mInput.next(numValues));
+  }
+
+  int nextPatternChannel() {
+    int chan = 1 + mInput.next(NumMidiChannels);
+    return chan == mChordChannel ? (chan % NumMidiChannels) + 1 : chan;
+  }
+
+  // Notes are taken in a few octaves, so that they often collide
+  NoteNumber nextNote() {
+    return 36 + mInput.next(48);
+  }
+
+  // The events of a block are generated in any order, so they are only
+  // followed once in the buffer
+  void updateHeldNotes() {
+    for (auto msgMD : mMidi) {
+      if (msgMD.numBytes != 3)
+        continue;
+      auto msg = msgMD.getMessage();
+      if (isMultiChannel() && msg.getChannel() == mChordChannel)
+        continue;
+      auto& held = mHeld[msg.getChannel() - 1];
+      if (msg.isNoteOn())
+        held[msg.getNoteNumber()] = true;
+      else if (msg.isNoteOff())
+        held[msg.getNoteNumber()] = false;
+      else if (msg.isAllNotesOff() || msg.isAllSoundOff())
+        std::fill(std::begin(held), std::end(held), false);
+    }
+  }
+
+  void addPatternEvent(const MidiMessage& msg, int pos) {
+    mMidi.addEvent(msg, pos);
+  }
+
+  void addChordEvent(const MidiMessage& msg, int pos) {
+    (isMultiChannel() ? mMidi : mChordMidi).addEvent(msg, pos);
+  }
+
+  void addRandomEvent(int blockSize) {
+    int pos = mInput.next(blockSize);
+    switch (mInput.next(10)) {
+    case 0: case 1: case 2:
+      addPatternEvent(MidiMessage::noteOn(nextPatternChannel(), nextNote(), (uint8)(1 + mInput.next(127))), pos);
+      break;
+    case 3: case 4:
+      addPatternEvent(MidiMessage::noteOff(nextPatternChannel(), nextNote(), (uint8)mInput.next(128)), pos);
+      break;
+    case 5:
+      // A NOTE ON with a velocity of 0 is a NOTE OFF
+      addPatternEvent(MidiMessage::noteOn(nextPatternChannel(), nextNote(), (uint8)0), pos);
+      break;
+    case 6:
+      addChordEvent(MidiMessage::noteOn(isMultiChannel() ? mChordChannel : 1, nextNote(), (uint8)100), pos);
+      break;
+    case 7:
+      addChordEvent(MidiMessage::noteOff(isMultiChannel() ? mChordChannel : 1, nextNote()), pos);
+      break;
+    case 8: {
+      // The receiver of these stops all the notes of the channel
+      int chan = nextPatternChannel();
+      mMidi.addEvent(mInput.next(2) ? MidiMessage::allNotesOff(chan) : MidiMessage::allSoundOff(chan), pos);
+      break;
+    }
+    default: {
+      const uint8 sysex[] = { 0xf0, 0x7d, (uint8)mInput.next(128), 0xf7 };
+      mMidi.addEvent(sysex, (int)sizeof(sysex), pos);
+      mMidi.addEvent(MidiMessage::controllerEvent(nextPatternChannel(), 1, mInput.next(128)), pos);
+      break;
+    }
+    }
+  }
+
+  void processBlock(int blockSize) {
+    AudioBuffer<float> audio(0, blockSize);
+    mPlayHead.setTimeInSamples(mBlockStart);
+    updateHeldNotes();
+    if (mChordInstance)
+      mChordInstance->processBlock(audio, mChordMidi);
+
+    // Arp only promises not to allocate while the events of a block fit the
+    // storage it reserved in prepareToPlay
+    int scratchCapacity = jmax(MinScratchCapacity, mMaxBlockSize);
+    int numEventsIn = mMidi.getNumEvents();
+    auto numAllocations = AllocationCounter::getNumAllocations();
+    auto numViolations = RealtimeChecks::getNumViolations();
+    mInstance->processBlock(audio, mMidi);
+    numAllocations = AllocationCounter::getNumAllocations() - numAllocations;
+    numViolations = RealtimeChecks::getNumViolations() - numViolations;
+    if (numEventsIn <= scratchCapacity && mMidi.data.size() <= scratchCapacity * OutputBytesPerEvent) {
+      check(numAllocations == 0, String(numAllocations) + " allocations in processBlock");
+      check(numViolations == 0, String(numViolations) + " real-time violations in processBlock");
+    }
+
+    mOutput.checkBlock(mMidi, blockSize);
+    mMidi.clear();
+    mChordMidi.clear();
+    mBlockStart += blockSize;
+  }
+
+public:
+  Scenario(const uint8* data, size_t size) : mInput(data, size) {
+  }
+
+  void run() {
+    static const int MaxBlockSizes[] = { 1, 7, 32, 64, 256, 512, 1024 };
+    mChordChannel = mInput.next(NumMidiChannels + 1);
+    mMaxBlockSize = MaxBlockSizes[mInput.next(numElementsInArray(MaxBlockSizes))];
+
+    mInstance.reset(createPluginFilter());
+    mInstance->setPlayHead(&mPlayHead);
+    if (isMultiChannel())
+      setParameter(*mInstance, "chordChan", mChordChannel);
+    else {
+      mChordInstance.reset(createPluginFilter());
+      mChordInstance->setPlayHead(&mPlayHead);
+      setParameter(*mChordInstance, "chordChan", InstanceBehaviour::IS_CHORD);
+      setParameter(*mInstance, "chordChan", InstanceBehaviour::IS_PATTERN);
+    }
+    for (int i = 0; i < numElementsInArray(FuzzedParameters); i++)
+      changeParameter();
+
+    // Room for all the events the host sends, and for what it gets back
+    mMidi.ensureSize(1 << 16);
+    mChordMidi.ensureSize(1 << 16);
+    if (mChordInstance)
+      mChordInstance->prepareToPlay(44100, mMaxBlockSize);
+    mInstance->prepareToPlay(44100, mMaxBlockSize);
+
+    while (!mInput.isExhausted()) {
+      if (mInput.next(8) == 0)
+        changeParameter();
+      int blockSize = 1 + mInput.next(mMaxBlockSize);
+      int numEvents = mInput.next(MaxEventsPerBlock + 1);
+      for (int i = 0; i < numEvents; i++)
+        addRandomEvent(blockSize);
+      processBlock(blockSize);
+    }
+
+    // Releases all the pattern notes still held, a few per block
+    int numEvents = 0;
+    for (int chan = 1; chan <= NumMidiChannels; chan++) {
+      for (int nn = 0; nn < NumMidiNotes; nn++) {
+        if (!mHeld[chan - 1][nn])
+          continue;
+        addPatternEvent(MidiMessage::noteOff(chan, nn), 0);
+        if (++numEvents == MaxEventsPerBlock) {
+          processBlock(mMaxBlockSize);
+          numEvents = 0;
+        }
+      }
+    }
+    processBlock(mMaxBlockSize);
+    mOutput.checkAllReleased();
+
+    mInstance->releaseResources();
+    if (mChordInstance)
+      mChordInstance->releaseResources();
+  }
+};
+
+// Runs the kernels of each instruction set the CPU supports on a random
+// chord and random mapping settings. The scalar kernels, which the others
+// must match bit for bit, are themselves checked against the note by note
+// mapping functions
+static void checkKernels(InputReader& input) {
+  const auto& scalar = *Kernels::get(Kernels::InstructionSet::SCALAR);
+
+  // Sometimes a few chord notes, sometimes most of the MIDI range
+  uint8_t counts[NumMidiNotes] = {};
+  int numNotes = input.next(2) ? 1 + input.next(12) : input.next(2 * NumMidiNotes);
+  for (int i = 0; i < numNotes; i++)
+    counts[input.next(NumMidiNotes)] = (uint8_t)(1 + input.next(UINT8_MAX));
+  Chord chord = scalar.heldNotes(counts);
+  for (NoteNumber nn = 0; nn < NumMidiNotes; nn++)
+    check(chord.contains(nn) == (counts[nn] != 0), "Scalar heldNotes is wrong for note " + String(nn));
+  if (chord.size() == 0)
+    return;
+
+  Kernels::DegreeParams params{};
+  for (NoteNumber nn : chord)
+    params.degrees[params.numChordDegrees++] = (uint8_t)nn;
+  // Wraparounds beyond those of the parameter, which the kernels support too
+  auto wrapMode = (PatternNotesWraparound::Enum)input.next(NumMidiNotes);
+  params.numValidDegrees = wrapMode == PatternNotesWraparound::NO_WRAPAROUND ? Kernels::NoWraparound
+    : wrapMode == PatternNotesWraparound::AFTER_ALL_CHORD_DEGREES ? params.numChordDegrees
+    : (int)wrapMode;
+  params.referenceNote = input.next(NumMidiNotes);
+  params.whiteKeysOnly = input.next(2) != 0;
+  auto mappingMode = params.whiteKeysOnly ? PatternNotesMapping::WHITE_NOTE_TO_DEGREE
+                                          : PatternNotesMapping::SEMITONE_TO_DEGREE;
+
+  int8_t expected[NumMidiNotes];
+  scalar.mapDegrees(params, expected);
+  for (NoteNumber nn = 0; nn < NumMidiNotes; nn++) {
+    Chord mapped;
+    Mapping::mapPatternNote(params.referenceNote, mappingMode, wrapMode, UnmappedNotesBehaviour::SILENCE,
+      chord, nn, mapped);
+    check(expected[nn] < 0 ? mapped.size() == 0 : mapped.size() == 1 && mapped[0] == expected[nn],
+      "Scalar mapDegrees is wrong for note " + String(nn));
+  }
+
+  for (int i = 1; i < Kernels::NumInstructionSets; i++) {
+    auto* kernels = Kernels::get((Kernels::InstructionSet)i);
+    if (kernels == nullptr)
+      continue;
+    check(kernels->heldNotes(counts) == chord, String(kernels->name) + " heldNotes differs from scalar");
+    int8_t notes[NumMidiNotes];
+    kernels->mapDegrees(params, notes);
+    for (NoteNumber nn = 0; nn < NumMidiNotes; nn++)
+      check(notes[nn] == expected[nn], String(kernels->name) + " mapDegrees differs from scalar for note " + String(nn));
+  }
+}
+
+// The notes turned on in a block, sorted
+static StringArray playedNotes(const MidiBuffer& midi) {
+  Array<int> notes;
+  for (auto msgMD : midi) {
+    auto msg = msgMD.getMessage();
+    if (msg.isNoteOn())
+      notes.addUsingDefaultSort(msg.getNoteNumber());
+  }
+  StringArray res;
+  for (int nn : notes)
+    res.add(String(nn));
+  return res;
+}
+
+// A chord instance goes through random chords, then the host jumps back on
+// its timeline to where one of the previous chords started, as when the user
+// seeks or at the end of a loop. The host doesn't send the held chord notes
+// again, so the pattern instance must keep using the chord that is held
+static void checkChordAfterSeek(InputReader& input) {
+  const int BlockSize = 64;
+  ToolPlayHead playHead;
+  std::unique_ptr<AudioProcessor> chordInstance(createPluginFilter()), patternInstance(createPluginFilter());
+  setParameter(*chordInstance, "chordChan", InstanceBehaviour::IS_CHORD);
+  setParameter(*patternInstance, "chordChan", InstanceBehaviour::IS_PATTERN);
+  int latencyMs = input.next(2) ? 0 : 15;
+  setParameter(*chordInstance, "numMillisecsOfLatency", latencyMs);
+  for (auto* instance : { chordInstance.get(), patternInstance.get() }) {
+    instance->setPlayHead(&playHead);
+    instance->prepareToPlay(44100, BlockSize);
+  }
+
+  int64 blockStart = 0;
+  MidiBuffer chordMidi, patternMidi;
+  AudioBuffer<float> audio(0, BlockSize);
+  auto processBlock = [&] {
+    playHead.setTimeInSamples(blockStart);
+    chordInstance->processBlock(audio, chordMidi);
+    patternInstance->processBlock(audio, patternMidi);
+    chordMidi.clear();
+    blockStart += BlockSize;
+  };
+
+  // Sometimes fewer chords than the timeline keeps, sometimes many more
+  int numChords = 1 + input.next(3 * ChordTimeline::NumSlots);
+  Array<int64> chordStarts;
+  Array<NoteNumber> heldNotes;
+  for (int i = 0; i < numChords; i++) {
+    for (NoteNumber nn : heldNotes)
+      chordMidi.addEvent(MidiMessage::noteOff(1, nn), 0);
+    NoteNumber root = 48 + input.next(12);
+    heldNotes = { root, root + 3 + input.next(2), root + 7 };
+    for (NoteNumber nn : heldNotes)
+      chordMidi.addEvent(MidiMessage::noteOn(1, nn, (uint8)100), 0);
+    chordStarts.add(blockStart);
+    processBlock();
+  }
+  // Until the pattern instance is past the lookahead of the chord instance
+  for (int64 end = blockStart + chordInstance->getLatencySamples(); blockStart <= end;)
+    processBlock();
+
+  auto playPatternNote = [&] {
+    patternMidi.addEvent(MidiMessage::noteOn(1, 60, (uint8)100), 0);
+    processBlock();
+    auto played = playedNotes(patternMidi);
+    patternMidi.clear();
+    patternMidi.addEvent(MidiMessage::noteOff(1, 60), 0);
+    processBlock();
+    patternMidi.clear();
+    return played;
+  };
+  auto expected = playPatternNote();
+  check(!expected.isEmpty(), "pattern note silenced with a chord held");
+
+  int64 seekedTo = chordStarts[input.next(numChords)];
+  blockStart = seekedTo;
+  auto played = playPatternNote();
+  check(played == expected,
+    "after " + String(numChords) + " chords, seeking back to " + String(seekedTo) + " played notes " +
+    played.joinIntoString(" ") + " instead of " + expected.joinIntoString(" "));
+
+  patternInstance->releaseResources();
+  chordInstance->releaseResources();
+}
+
+// Pattern notes turned on, off and on again, often in the same group of events
+// (as always happens in per-block mode), under a chord which maps every
+// pattern note to at least one note. Only one pattern note is played on each
+// channel, so after each block, some note must be playing on a channel if and
+// only if its pattern note is held
+static void checkRetriggers(InputReader& input) {
+  const int MaxBlockSize = 64;
+  const int ChordChannel = 16;
+  const int NumPatternChannels = 3;
+  std::unique_ptr<AudioProcessor> instance(createPluginFilter());
+  setParameter(*instance, "chordChan", ChordChannel);
+  setParameter(*instance, "eventTiming", input.next(2));
+  setParameter(*instance, "patternNotesMapping", input.next(PatternNotesMapping::WHITE_NOTE_TO_DEGREE + 1));
+  setParameter(*instance, "unmappedNotesBehaviour", UnmappedNotesBehaviour::USE_AS_IS);
+  instance->prepareToPlay(44100, MaxBlockSize);
+
+  NoteNumber patternNotes[NumPatternChannels];
+  bool held[NumPatternChannels] = {};
+  int numPlaying[NumPatternChannels] = {};
+  for (auto& nn : patternNotes)
+    nn = (NoteNumber)(48 + input.next(36));
+
+  MidiBuffer midi;
+  AudioBuffer<float> audio(0, MaxBlockSize);
+  for (NoteNumber nn : { 48, 52, 55 })
+    midi.addEvent(MidiMessage::noteOn(ChordChannel, nn, (uint8)100), 0);
+
+  int numBlocks = 1 + input.next(32);
+  for (int block = 0; block < numBlocks; block++) {
+    int blockSize = 1 + input.next(MaxBlockSize);
+    // A few positions only, so that many events share the same one
+    int numEvents = input.next(12);
+    for (int i = 0; i < numEvents; i++) {
+      int c = input.next(NumPatternChannels);
+      int pos = input.next(3) * (blockSize - 1) / 2;
+      int kind = input.next(3);
+      auto msg = kind == 0 ? MidiMessage::noteOn(c + 1, patternNotes[c], (uint8)100)
+               : kind == 1 ? MidiMessage::noteOff(c + 1, patternNotes[c])
+                           : MidiMessage::noteOn(c + 1, patternNotes[c], (uint8)0);
+      midi.addEvent(msg, pos);
+    }
+    // The input, in the order the instance gets it
+    for (auto msgMD : midi) {
+      auto msg = msgMD.getMessage();
+      if (msg.getChannel() <= NumPatternChannels && msg.isNoteOnOrOff())
+        held[msg.getChannel() - 1] = msg.isNoteOn();
+    }
+
+    audio.setSize(0, blockSize);
+    instance->processBlock(audio, midi);
+    for (auto msgMD : midi) {
+      auto msg = msgMD.getMessage();
+      if (msg.getChannel() > NumPatternChannels)
+        continue;
+      if (msg.isNoteOn())
+        numPlaying[msg.getChannel() - 1]++;
+      else if (msg.isNoteOff())
+        numPlaying[msg.getChannel() - 1]--;
+    }
+    midi.clear();
+
+    for (int c = 0; c < NumPatternChannels; c++)
+      check(held[c] == (numPlaying[c] > 0),
+        "after block " + String(block) + ", note " + String(patternNotes[c]) + " on channel " + String(c + 1) +
+        (held[c] ? " is held, but nothing is playing" : " is released, but " + String(numPlaying[c]) +
+                                                           " notes are still playing"));
+  }
+
+  instance->releaseResources();
+}
+
+// Returns an empty string if all the checks passed
+static String runScenario(const uint8* data, size_t size) {
+  try {
+    InputReader kernelInput(data, size);
+    checkKernels(kernelInput);
+    InputReader seekInput(data, size);
+    checkChordAfterSeek(seekInput);
+    InputReader retriggerInput(data, size);
+    checkRetriggers(retriggerInput);
+    Scenario(data, size).run();
+  }
+  catch (const InvariantViolation& violation) {
+    return violation.description;
+  }
+  return {};
+}
+
+
+#if ARPLIGNER_LIBFUZZER
+
+extern "C" int LLVMFuzzerInitialize(int*, char***) {
+  // Never destroyed, as libFuzzer exits without returning
+  new ScopedJuceInitialiser_GUI();
+  return 0;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  auto failure = runScenario(data, size);
+  if (failure.isNotEmpty()) {
+    std::cerr << "Check failed: " << failure << std::endl;
+    abort();
+  }
+  return 0;
+}
+
+#else
+
+static MemoryBlock randomInput(int64 seed, int maxLength) {
+  Random rng(seed);
+  MemoryBlock input((size_t)rng.nextInt(maxLength + 1));
+  for (size_t i = 0; i < input.getSize(); i++)
+    input[i] = (char)rng.nextInt(256);
+  return input;
+}
+
+static int reportFailure(const String& failure, const MemoryBlock& input, const String& inputName) {
+  File saved = File::getCurrentWorkingDirectory().getChildFile("arpligner-fuzz-failure.bin");
+  saved.replaceWithData(input.getData(), input.getSize());
+  std::cout << "Check failed with " << inputName << ": " << failure << std::endl
+            << "The input was saved to " << saved.getFullPathName() << std::endl;
+  return 1;
+}
+
+static int fuzz(const ArgumentList& args) {
+  if (args.containsOption("--help|-h")) {
+    std::cout << Usage;
+    return 0;
+  }
+
+  // Replaying inputs
+  if (args.size() > 0 && !args[0].isOption()) {
+    for (int i = 0; i < args.size(); i++) {
+      MemoryBlock input;
+      File file = existingFile(args[i].text);
+      file.loadFileAsData(input);
+      auto failure = runScenario(static_cast<const uint8*>(input.getData()), input.getSize());
+      if (failure.isNotEmpty())
+        return reportFailure(failure, input, file.getFileName());
+      std::cout << file.getFileName() << ": all checks passed" << std::endl;
+    }
+    return 0;
+  }
+
+  int numRuns = intOptionValue(args, "--runs", 10000, 1, std::numeric_limits<int>::max());
+  int maxLength = intOptionValue(args, "--max-length", 4096, 1, 1 << 24);
+  int64 firstSeed = args.containsOption("--seed")
+    ? intOptionValue(args, "--seed", 0, 0, std::numeric_limits<int>::max())
+    : Random::getSystemRandom().nextInt(std::numeric_limits<int>::max());
+
+  if (RealtimeChecks::isAvailable())
+    std::cout << "(built with real-time checks: allocations, locks and blocking calls are checked)" << std::endl;
+  else if (!AllocationCounter::isAvailable())
+    std::cout << "(allocations are not checked on this platform)" << std::endl;
+  StringArray checkedKernels;
+  for (int i = 1; i < Kernels::NumInstructionSets; i++)
+    if (auto* kernels = Kernels::get((Kernels::InstructionSet)i))
+      checkedKernels.add(kernels->name);
+  std::cout << "(kernels checked against scalar: "
+            << (checkedKernels.isEmpty() ? String("none") : checkedKernels.joinIntoString(", ")) << ")" << std::endl;
+
+  auto startTime = Time::getHighResolutionTicks();
+  for (int run = 0; run < numRuns; run++) {
+    int64 seed = firstSeed + run;
+    auto input = randomInput(seed, maxLength);
+    auto failure = runScenario(static_cast<const uint8*>(input.getData()), input.getSize());
+    if (failure.isNotEmpty())
+      return reportFailure(failure, input, "seed " + String(seed));
+  }
+  double elapsed = Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - startTime);
+  std::cout << "All checks passed for " << numRuns << " inputs (seeds " << firstSeed << " to "
+            << firstSeed + numRuns - 1 << ") in " << String(elapsed, 1) << " s" << std::endl;
+  return 0;
+}
+
+int main(int argc, char* argv[]) {
+  ScopedJuceInitialiser_GUI juceInit;
+  ArgumentList args(argc, argv);
+  return ConsoleApplication::invokeCatchingFailures([&] { return fuzz(args); });
+}
+
+#endif
@@ -0,0 +1,243 @@
+/*
+  ==============================================================================
+
+    Main.cpp
+
+    ArplignerRender: runs Arpligner offline over Standard MIDI Files, the same
+    way a host would run it in real time
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "PluginProcessor.h"
+#include "../Common/ToolUtils.h"
+#include "../Common/Rendering.h"
+
+
+static const char* const Usage =
+  "Usage: ArplignerRender --chords FILE --pattern FILE [--pattern FILE...] --output FILE\n"
+  "                       [--mode multi-instance|multi-channel] [--chord-channel N]\n"
+  "                       [--block-size N] [--sample-rate N] [--param ID=VALUE...]\n"
+  "                       [--compare FILE] [--check-block-sizes]\n"
+  "       ArplignerRender --list-params\n"
+  "\n"
+  "  --chords FILE        Standard MIDI File containing the chords\n"
+  "  --pattern FILE       Standard MIDI File containing a pattern. Can be repeated\n"
+  "  --output FILE        Where to write the resulting Standard MIDI File\n"
+  "  --mode MODE          multi-instance (default): one chord instance, and one\n"
+  "                       pattern instance per pattern file, each one rendered to\n"
+  "                       its own track.\n"
+  "                       multi-channel: one single instance receiving the chords\n"
+  "                       on the chord channel and all the patterns, rendered to\n"
+  "                       one single track\n"
+  "  --chord-channel N    Chord channel in multi-channel mode (default: 16)\n"
+  "  --block-size N       Size of the blocks, in samples (default: 512)\n"
+  "  --sample-rate N      Sample rate, in Hz (default: 44100)\n"
+  "  --param ID=VALUE     Sets a parameter of every instance. VALUE is the index of\n"
+  "                       the choice (or the value itself for numeric parameters)\n"
+  "  --compare FILE       Checks that the output is identical to FILE, e.g. an output\n"
+  "                       rendered before some change to the engine\n"
+  "  --check-block-sizes  Checks that the output is the same with block sizes from\n"
+  "                       1 to 4096 samples (needs sample-accurate event timing)\n"
+  "  --list-params        Lists the parameters that can be set with --param\n"
+  "\n"
+  "Checks that fail make the program exit with an error.\n";
+
+
+static void listParameters() {
+  std::unique_ptr<AudioProcessor> processor(createPluginFilter());
+  for (auto* param : processor->getParameters()) {
+    auto* ranged = dynamic_cast<RangedAudioParameter*>(param);
+    if (ranged == nullptr)
+      continue;
+    std::cout << ranged->paramID << " (" << ranged->getName(100) << ")" << std::endl;
+    if (auto* choice = dynamic_cast<AudioParameterChoice*>(ranged)) {
+      for (int i = 0; i < choice->choices.size(); i++)
+        std::cout << "  " << i << ": " << choice->choices[i] << std::endl;
+    }
+    else {
+      auto range = ranged->getNormalisableRange();
+      std::cout << "  " << range.start << " to " << range.end << std::endl;
+    }
+  }
+}
+
+static MidiFile readMidiFile(const File& file) {
+  FileInputStream stream(file);
+  MidiFile midiFile;
+  if (!stream.openedOk() || !midiFile.readFrom(stream))
+    fail("Could not read MIDI file " + file.getFullPathName());
+  if (midiFile.getTimeFormat() <= 0)
+    fail(file.getFullPathName() + " uses SMPTE timecode, which is not supported");
+  return midiFile;
+}
+
+// Merges all the tracks of a MIDI file, keeping only the events Arpligner is
+// interested in, and converts their timestamps from ticks to samples
+static MidiMessageSequence readEvents(const File& file, double sampleRate) {
+  MidiFile midiFile = readMidiFile(file);
+  midiFile.convertTimestampTicksToSeconds();
+  MidiMessageSequence events;
+  for (int t = 0; t < midiFile.getNumTracks(); t++) {
+    for (auto* holder : *midiFile.getTrack(t)) {
+      auto msg = holder->message;
+      if (msg.isMetaEvent())
+        continue;
+      msg.setTimeStamp(std::round(msg.getTimeStamp() * sampleRate));
+      events.addEvent(msg);
+    }
+  }
+  events.sort();
+  return events;
+}
+
+// Inverse of MidiFile::convertTimestampTicksToSeconds, following the tempo
+// changes of tempoEvents (timestamped in ticks)
+static double secondsToTicks(double seconds, const MidiMessageSequence& tempoEvents, int ticksPerQuarterNote) {
+  double curTicks = 0, curSeconds = 0, secsPerQuarterNote = 0.5;
+  for (auto* holder : tempoEvents) {
+    auto& msg = holder->message;
+    double secsUntilEvent = (msg.getTimeStamp() - curTicks) / ticksPerQuarterNote * secsPerQuarterNote;
+    if (curSeconds + secsUntilEvent > seconds)
+      break;
+    curSeconds += secsUntilEvent;
+    curTicks = msg.getTimeStamp();
+    secsPerQuarterNote = msg.getTempoSecondsPerQuarterNote();
+  }
+  return curTicks + (seconds - curSeconds) / secsPerQuarterNote * ticksPerQuarterNote;
+}
+
+// Sample-accurate rendering must not depend on how the host cuts the timeline
+// into blocks. Renders again with each of these block sizes, and compares
+// with the reference rendering
+static void checkBlockSizes(const RenderSettings& settings, const Array<MidiMessageSequence>& reference,
+  int referenceBlockSize) {
+  for (auto& [paramID, value] : settings.params)
+    if (paramID == "eventTiming" && value != EventTiming::SAMPLE_ACCURATE)
+      fail("--check-block-sizes needs sample-accurate event timing");
+
+  bool allIdentical = true;
+  for (int blockSize : BlockSizesToCheck) {
+    if (blockSize == referenceBlockSize)
+      continue;
+    RenderStats stats;
+    auto difference = findFirstDifference(reference, renderTracks(settings, blockSize, stats));
+    std::cout << "Block size " << blockSize << ": "
+              << (difference.isEmpty() ? String("identical") : "differs (" + difference + ")")
+              << std::endl;
+    allIdentical = allIdentical && difference.isEmpty();
+  }
+  if (!allIdentical)
+    fail("The output depends on the block size");
+}
+
+// Compares the rendered file with a reference one (e.g. rendered by a previous
+// version), after reading both the same way
+static void compareWithReference(const File& outputFile, const File& referenceFile) {
+  MidiFile output = readMidiFile(outputFile), reference = readMidiFile(referenceFile);
+  Array<MidiMessageSequence> outputTracks, referenceTracks;
+  for (int t = 0; t < output.getNumTracks(); t++)
+    outputTracks.add(*output.getTrack(t));
+  for (int t = 0; t < reference.getNumTracks(); t++)
+    referenceTracks.add(*reference.getTrack(t));
+  auto difference = findFirstDifference(referenceTracks, outputTracks);
+  if (difference.isEmpty() && output.getTimeFormat() != reference.getTimeFormat())
+    difference = "different time formats";
+  if (difference.isNotEmpty())
+    fail("The output differs from " + referenceFile.getFullPathName() + " (" + difference + ")");
+  std::cout << "The output is identical to " << referenceFile.getFullPathName() << std::endl;
+}
+
+static int render(const ArgumentList& args) {
+  if (args.containsOption("--help|-h")) {
+    std::cout << Usage;
+    return 0;
+  }
+  if (args.containsOption("--list-params")) {
+    listParameters();
+    return 0;
+  }
+
+  RenderSettings settings;
+  File chordsFile = existingFile(optionValue(args, "--chords"));
+  File outputFile = File::getCurrentWorkingDirectory().getChildFile(optionValue(args, "--output"));
+  Array<File> patternFiles;
+  for (int i = 0; i < args.size(); i++)
+    if (args[i].isLongOption("pattern"))
+      patternFiles.add(existingFile(optionValueAt(args, i)));
+  settings.params = parameterOptions(args);
+  if (patternFiles.isEmpty())
+    fail("At least one --pattern file is needed");
+  File referenceFile;
+  if (args.containsOption("--compare"))
+    referenceFile = existingFile(optionValue(args, "--compare"));
+
+  auto mode = optionValue(args, "--mode", "multi-instance");
+  if (mode != "multi-instance" && mode != "multi-channel")
+    fail("Unknown mode '" + mode + "'");
+  settings.multiChannel = mode == "multi-channel";
+  settings.chordChannel = intOptionValue(args, "--chord-channel", 16, 1, 16);
+  int blockSize = intOptionValue(args, "--block-size", 512, 1, 1 << 20);
+  settings.sampleRate = intOptionValue(args, "--sample-rate", 44100, 1000, 1000000);
+
+  // The tempo map and resolution of the chords file are used to convert the
+  // output back to ticks
+  MidiFile chordsMidiFile = readMidiFile(chordsFile);
+  int ticksPerQuarterNote = chordsMidiFile.getTimeFormat();
+  MidiMessageSequence tempoEvents, timeSigEvents;
+  chordsMidiFile.findAllTempoEvents(tempoEvents);
+  chordsMidiFile.findAllTimeSigEvents(timeSigEvents);
+
+  settings.chordEvents = readEvents(chordsFile, settings.sampleRate);
+  for (auto& file : patternFiles)
+    settings.patternEvents.add(readEvents(file, settings.sampleRate));
+
+  RenderStats stats;
+  auto tracks = renderTracks(settings, blockSize, stats);
+
+  MidiFile result;
+  result.setTicksPerQuarterNote(ticksPerQuarterNote);
+  MidiMessageSequence conductorTrack;
+  conductorTrack.addSequence(tempoEvents, 0);
+  conductorTrack.addSequence(timeSigEvents, 0);
+  conductorTrack.updateMatchedPairs();
+  result.addTrack(conductorTrack);
+  for (auto track : tracks) {
+    for (auto* holder : track) {
+      double seconds = holder->message.getTimeStamp() / settings.sampleRate;
+      holder->message.setTimeStamp(std::round(secondsToTicks(seconds, tempoEvents, ticksPerQuarterNote)));
+    }
+    track.updateMatchedPairs();
+    result.addTrack(track);
+  }
+
+  outputFile.deleteFile();
+  {
+    FileOutputStream stream(outputFile);
+    if (!stream.openedOk() || !result.writeTo(stream))
+      fail("Could not write MIDI file " + outputFile.getFullPathName());
+  }
+
+  std::cout << "Rendered " << stats.numEventsIn << " events in " << String(stats.elapsedSeconds * 1000, 2) << " ms ("
+            << (int64)(stats.numEventsIn / jmax(stats.elapsedSeconds, 1e-9)) << " events/s, "
+            << stats.numBlocks << " blocks of " << blockSize << " samples)"
+            << std::endl;
+
+  if (referenceFile != File())
+    compareWithReference(outputFile, referenceFile);
+
+  if (args.containsOption("--check-block-sizes"))
+    checkBlockSizes(settings, tracks, blockSize);
+  return 0;
+}
+
+int main(int argc, char* argv[]) {
+  ScopedJuceInitialiser_GUI juceInit;
+  ArgumentList args(argc, argv);
+  if (args.size() == 0) {
+    std::cout << Usage;
+    return 1;
+  }
+  return ConsoleApplication::invokeCatchingFailures([&] { return render(args); });
+}
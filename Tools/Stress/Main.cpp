@@ -0,0 +1,446 @@
+/*
+  ==============================================================================
+
+    Main.cpp
+
+    ArplignerStress: runs global chord instances and many pattern instances
+    (Multi-instance mode) in parallel on a pool of threads, the way a host
+    processes the tracks of a big project, and measures how they cope
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include <thread>
+#include "ChordStore.h"
+#include "SharedChordBuses.h"
+#include "../Common/ToolUtils.h"
+#include "../Common/AllocationCounter.h"
+#if ! JUCE_WINDOWS
+ #include <sys/wait.h>
+ #include <unistd.h>
+#endif
+
+
+static const char* const Usage =
+  "Usage: ArplignerStress [--instances N] [--buses N] [--threads N] [--seconds N]\n"
+  "                       [--block-size N] [--sample-rate N] [--events-per-block N]\n"
+  "                       [--free-running] [--shared] [--role chord|pattern|both]\n"
+  "                       [--dead-writer] [--param ID=VALUE...]\n"
+  "       ArplignerStress --check-timeline [--threads N] [--seconds N]\n"
+  "\n"
+  "  --instances N         Number of pattern instances (default: 128)\n"
+  "  --buses N             Number of chord buses, each one with its own chord\n"
+  "                        instance. Pattern instances are spread over them\n"
+  "                        (default: 1)\n"
+  "  --threads N           Number of audio threads, the main one included\n"
+  "                        (default: number of CPU cores)\n"
+  "  --seconds N           Duration of audio to process (default: 10)\n"
+  "  --block-size N        Size of the blocks, in samples (default: 256)\n"
+  "  --sample-rate N       Sample rate, in Hz (default: 48000)\n"
+  "  --events-per-block N  Average number of pattern events each instance gets\n"
+  "                        per block (default: 2)\n"
+  "  --free-running        Starts each block as soon as the previous one is done,\n"
+  "                        instead of following the audio clock\n"
+  "  --shared              Uses the chord buses shared by all processes\n"
+  "  --role ROLE           Only runs the chord instances, or only the pattern\n"
+  "                        instances (default: both). With --shared, two\n"
+  "                        processes can play each role at the same time\n"
+  "  --dead-writer         With --shared, a process dies holding the writer lock\n"
+  "                        of each bus before the run. The chord instances must\n"
+  "                        skip their blocks without waiting, then take it over\n"
+  "  --param ID=VALUE      Sets a parameter of every instance\n"
+  "\n"
+  "  --check-timeline      Instead, one thread publishes chords as fast as it can\n"
+  "                        on a chord timeline, and the others read them back,\n"
+  "                        at random positions. Fails if a reader ever gets a\n"
+  "                        snapshot mixing several chords\n";
+
+// The chord instance plays a new chord every that many seconds
+const double ChordDuration = 0.5;
+
+
+// One plugin instance, and what it needs to generate its input
+struct Job {
+  std::unique_ptr<AudioProcessor> processor;
+  MidiBuffer midi;
+  Random rng;
+  bool isChordInstance = false;
+  int channel = 1;
+  bool heldNotes[128] = {};
+};
+
+
+// Simulates the audio engine of a host: each block, all the jobs are processed
+// by a pool of threads (the calling thread included), and the block is done
+// once the last job is
+class HostSimulator {
+private:
+  std::vector<Job>& mJobs;
+  ToolPlayHead& mPlayHead;
+  int mBlockSize;
+  double mSampleRate;
+  double mEventsPerBlock;
+
+  std::vector<std::thread> mWorkers;
+  std::vector<std::unique_ptr<WaitableEvent>> mWakeUpEvents;
+  std::atomic<bool> mShouldExit{ false };
+
+  std::atomic<int> mCurBlock{ 0 };
+  std::atomic<int> mNextJob{ 0 };
+  std::atomic<int> mNumJobsDone{ 0 };
+
+  void generateInput(Job& job, int block) {
+    job.midi.clear();
+    if (job.isChordInstance) {
+      // A new random triad at the beginning of each chord
+      int blocksPerChord = jmax(1, (int)std::round(ChordDuration * mSampleRate / mBlockSize));
+      if (block % blocksPerChord != 0)
+        return;
+      for (int nn = 0; nn < 128; nn++)
+        if (job.heldNotes[nn]) {
+          job.midi.addEvent(MidiMessage::noteOff(job.channel, nn), 0);
+          job.heldNotes[nn] = false;
+        }
+      int root = 48 + job.rng.nextInt(12);
+      for (int offset : { 0, job.rng.nextBool() ? 3 : 4, 7 }) {
+        job.midi.addEvent(MidiMessage::noteOn(job.channel, root + offset, (uint8)100), 0);
+        job.heldNotes[root + offset] = true;
+      }
+      return;
+    }
+    int numEvents = job.rng.nextInt((int)(2 * mEventsPerBlock) + 1);
+    for (int i = 0; i < numEvents; i++) {
+      int nn = 48 + job.rng.nextInt(36);
+      int pos = job.rng.nextInt(mBlockSize);
+      if (job.heldNotes[nn])
+        job.midi.addEvent(MidiMessage::noteOff(job.channel, nn), pos);
+      else
+        job.midi.addEvent(MidiMessage::noteOn(job.channel, nn, (uint8)(1 + job.rng.nextInt(127))), pos);
+      job.heldNotes[nn] = !job.heldNotes[nn];
+    }
+  }
+
+  void processJobs() {
+    // MIDI effects have no audio channels, but still need a buffer
+    thread_local AudioBuffer<float> audio(0, mBlockSize);
+    for (int j = mNextJob++; j < (int)mJobs.size(); j = mNextJob++) {
+      int block = mCurBlock.load();
+      auto& job = mJobs[j];
+      generateInput(job, block);
+
+      int64 allocsBefore = AllocationCounter::getNumAllocations();
+      auto start = std::chrono::steady_clock::now();
+      job.processor->processBlock(audio, job.midi);
+      auto end = std::chrono::steady_clock::now();
+      numAllocations += AllocationCounter::getNumAllocations() - allocsBefore;
+
+      processTimes[(size_t)block * mJobs.size() + j] = std::chrono::duration<float>(end - start).count();
+      mNumJobsDone++;
+    }
+  }
+
+public:
+  // Time each job took to process each block, in seconds, indexed by
+  // block * numJobs + job
+  std::vector<float> processTimes;
+  std::atomic<int64> numAllocations{ 0 };
+
+  HostSimulator(std::vector<Job>& jobs, ToolPlayHead& playHead, int numThreads, int numBlocks,
+    int blockSize, double sampleRate, double eventsPerBlock)
+    : mJobs(jobs), mPlayHead(playHead), mBlockSize(blockSize), mSampleRate(sampleRate), mEventsPerBlock(eventsPerBlock),
+      processTimes((size_t)numBlocks * jobs.size()) {
+    for (int t = 1; t < numThreads; t++) {
+      mWakeUpEvents.push_back(std::make_unique<WaitableEvent>());
+      auto* wakeUp = mWakeUpEvents.back().get();
+      mWorkers.emplace_back([this, wakeUp] {
+        for (;;) {
+          wakeUp->wait();
+          if (mShouldExit)
+            return;
+          processJobs();
+        }
+      });
+    }
+  }
+
+  ~HostSimulator() {
+    mShouldExit = true;
+    for (auto& wakeUp : mWakeUpEvents)
+      wakeUp->signal();
+    for (auto& worker : mWorkers)
+      worker.join();
+  }
+
+  void processBlock(int block) {
+    // A worker that wakes up late may still grab jobs of this block, so the
+    // block number and position have to be set before the jobs are made
+    // available
+    mCurBlock = block;
+    mPlayHead.setTimeInSamples((int64)block * mBlockSize);
+    mNumJobsDone = 0;
+    mNextJob = 0;
+    for (auto& wakeUp : mWakeUpEvents)
+      wakeUp->signal();
+    processJobs();
+    while (mNumJobsDone.load() < (int)mJobs.size())
+      std::this_thread::yield();
+  }
+};
+
+
+static float percentile(std::vector<float>& sortedValues, double p) {
+  if (sortedValues.empty())
+    return 0;
+  return sortedValues[(size_t)std::round(p * (sortedValues.size() - 1))];
+}
+
+static void printPercentiles(const char* label, std::vector<float> values) {
+  std::sort(values.begin(), values.end());
+  std::printf("%-24s p50 %8.1f  p90 %8.1f  p99 %8.1f  p99.9 %8.1f  max %8.1f\n", label,
+    percentile(values, 0.5) * 1e6, percentile(values, 0.9) * 1e6, percentile(values, 0.99) * 1e6,
+    percentile(values, 0.999) * 1e6, percentile(values, 1) * 1e6);
+}
+
+// Starts a process that takes the writer lock of the first numBuses shared
+// buses, and dies without releasing them, as if it crashed
+static void killWriterHoldingLocks(int numBuses) {
+#if JUCE_WINDOWS
+  ignoreUnused(numBuses);
+  fail("--dead-writer is not available on Windows");
+#else
+  pid_t pid = fork();
+  if (pid < 0)
+    fail("Could not start the dead writer");
+  if (pid == 0) {
+    for (int bus = 0; bus < numBuses; bus++)
+      new GlobalChordStore::ScopedWriteLock(ChordBuses::getInstance()->getBus(bus, ChordBusScope::ALL_PROCESSES));
+    _exit(0);
+  }
+  int status = 0;
+  waitpid(pid, &status, 0);
+#endif
+}
+
+// Chord number k is made of notes k % 64 and 64 + k % 64, which are in the
+// two different words of a Chord. A snapshot copied while the writer was
+// rewriting it would most likely mix the words of two chords
+static bool isWholeTimelineChord(const Chord& chord) {
+  if (chord.size() == 0)
+    return true;
+  NoteNumber low = chord[0];
+  return chord.size() == 2 && low < 64 && chord.contains(low + 64);
+}
+
+static int checkTimeline(const ArgumentList& args) {
+  int numReaders = intOptionValue(args, "--threads", jmax(2, SystemStats::getNumCpus()), 2, 1024) - 1;
+  int numSeconds = intOptionValue(args, "--seconds", 10, 1, 100000);
+  // Far enough apart for the readers to look up positions between them
+  const TimelinePosition Spacing = 16;
+
+  ChordTimeline timeline;
+  GlobalChordStore store(timeline);
+  std::atomic<bool> stop{ false };
+  std::atomic<TimelinePosition> lastPosition{ 0 };
+  std::atomic<int64> numReads{ 0 }, numTornReads{ 0 };
+
+  std::vector<std::thread> readers;
+  for (int r = 0; r < numReaders; r++)
+    readers.emplace_back([&, r] {
+      Random rng(r);
+      int64 reads = 0;
+      while (!stop.load(std::memory_order_relaxed)) {
+        // Mostly positions of entries the writer may be overwriting
+        TimelinePosition position = lastPosition.load(std::memory_order_relaxed) -
+          rng.nextInt(ChordTimeline::NumSlots + 4) * Spacing;
+        ChordSnapshot snapshot;
+        store.getChordAt(rng.nextInt(8) == 0 ? UnknownPosition : position, snapshot);
+        if (!isWholeTimelineChord(snapshot.chord) || !snapshot.shouldProcess || snapshot.shouldSilence)
+          numTornReads.fetch_add(1, std::memory_order_relaxed);
+        reads++;
+      }
+      numReads.fetch_add(reads, std::memory_order_relaxed);
+    });
+
+  int64 numPublished = 0;
+  auto end = Time::getMillisecondCounterHiRes() + numSeconds * 1000.0;
+  for (int64 k = 1; Time::getMillisecondCounterHiRes() < end; k++) {
+    const GlobalChordStore::ScopedWriteLock lock(store);
+    NoteNumber previous = (NoteNumber)((k - 1) % 64), next = (NoteNumber)(k % 64);
+    if (k > 1) {
+      store.rmChordNote(previous);
+      store.rmChordNote(previous + 64);
+    }
+    store.addChordNote(next);
+    store.addChordNote(next + 64);
+    store.updateCurrentChord(WhenNoChordNote::LATCH_LAST_CHORD, WhenSingleChordNote::USE_AS_IS, k * Spacing);
+    lastPosition.store(k * Spacing, std::memory_order_relaxed);
+    numPublished++;
+  }
+  stop.store(true);
+  for (auto& reader : readers)
+    reader.join();
+
+  auto contention = store.getContention();
+  std::printf("%lld chords published, %lld reads on %d threads, %llu failed read attempts, %llu stale reads\n",
+    (long long)numPublished, (long long)numReads.load(), numReaders,
+    (unsigned long long)contention.numFailedReadAttempts, (unsigned long long)contention.numStaleReads);
+  if (numTornReads.load() > 0)
+    fail(String(numTornReads.load()) + " reads got a torn snapshot");
+  return 0;
+}
+
+static int runStress(const ArgumentList& args) {
+  if (args.containsOption("--help|-h")) {
+    std::cout << Usage;
+    return 0;
+  }
+  if (args.containsOption("--check-timeline"))
+    return checkTimeline(args);
+
+  int numInstances = intOptionValue(args, "--instances", 128, 1, 100000);
+  int numBuses = intOptionValue(args, "--buses", 1, 1, NumChordBuses);
+  int numThreads = intOptionValue(args, "--threads", SystemStats::getNumCpus(), 1, 1024);
+  int numSeconds = intOptionValue(args, "--seconds", 10, 1, 100000);
+  int blockSize = intOptionValue(args, "--block-size", 256, 1, 1 << 16);
+  double sampleRate = intOptionValue(args, "--sample-rate", 48000, 1000, 1000000);
+  int eventsPerBlock = intOptionValue(args, "--events-per-block", 2, 0, 1000);
+  bool freeRunning = args.containsOption("--free-running");
+  auto scope = args.containsOption("--shared") ? ChordBusScope::ALL_PROCESSES : ChordBusScope::THIS_PROCESS;
+  auto role = optionValue(args, "--role", "both");
+  if (role != "chord" && role != "pattern" && role != "both")
+    fail("Unknown role '" + role + "'");
+  bool deadWriter = args.containsOption("--dead-writer");
+  if (deadWriter && (scope != ChordBusScope::ALL_PROCESSES || role == "pattern"))
+    fail("--dead-writer needs --shared, and chord instances");
+  auto params = parameterOptions(args);
+
+  int numChordInstances = role != "pattern" ? numBuses : 0;
+  if (role == "chord")
+    numInstances = 0;
+
+  // The chord instances are the first jobs, so each block they are the first
+  // ones to start, but they may still finish after some of the pattern
+  // instances
+  ToolPlayHead playHead;
+  std::vector<Job> jobs((size_t)(numChordInstances + numInstances));
+  for (int i = 0; i < (int)jobs.size(); i++) {
+    auto& job = jobs[(size_t)i];
+    job.processor.reset(createPluginFilter());
+    job.processor->setPlayHead(&playHead);
+    job.isChordInstance = i < numChordInstances;
+    job.channel = job.isChordInstance ? 1 : 1 + (i - numChordInstances) % 16;
+    job.rng.setSeed((int64)i);
+    job.midi.ensureSize(4096);
+    for (auto& [paramID, value] : params)
+      setParameter(*job.processor, paramID, value);
+    setParameter(*job.processor, "chordChan",
+      job.isChordInstance ? InstanceBehaviour::IS_CHORD : InstanceBehaviour::IS_PATTERN);
+    setParameter(*job.processor, "chordBus", (job.isChordInstance ? i : i - numChordInstances) % numBuses);
+    setParameter(*job.processor, "chordBusScope", scope);
+    job.processor->prepareToPlay(sampleRate, blockSize);
+  }
+  // Another process may be initialising the segment at the same time
+  bool sharedBusesOpen = scope != ChordBusScope::ALL_PROCESSES;
+  for (int attempt = 0; !sharedBusesOpen && attempt < 2000; attempt++) {
+    sharedBusesOpen = ChordBuses::getInstance()->openSharedBuses();
+    if (!sharedBusesOpen)
+      Thread::sleep(1);
+  }
+  if (!sharedBusesOpen)
+    fail("Could not open the shared chord buses " + SharedChordBuses::getSegmentName());
+  if (deadWriter)
+    killWriterHoldingLocks(numBuses);
+
+  int numBlocks = (int)(numSeconds * sampleRate / blockSize);
+  double blockDuration = blockSize / sampleRate;
+  std::printf("%d blocks of %d samples at %g Hz (%.2f ms each), %d chord instance(s) + %d pattern instances on %d threads%s\n",
+    numBlocks, blockSize, sampleRate, blockDuration * 1000, numChordInstances, numInstances, numThreads,
+    freeRunning ? ", free running" : "");
+
+  std::vector<float> blockTimes((size_t)numBlocks);
+  int numDeadlineMisses = 0;
+  double maxLateness = 0;
+  // The latest chord of each bus, checked after each block
+  std::vector<Chord> lastChords((size_t)numBuses);
+  std::vector<int> numChordChanges((size_t)numBuses);
+  for (int bus = 0; bus < numBuses; bus++)
+    ChordBuses::getInstance()->getBus(bus, scope).resetContention();
+  {
+    HostSimulator host(jobs, playHead, numThreads, numBlocks, blockSize, sampleRate, eventsPerBlock);
+    auto clockStart = Time::getHighResolutionTicks();
+    for (int block = 0; block < numBlocks; block++) {
+      // Block n is due by the time the audio clock reaches the end of block
+      // n, as the audio device plays it while block n+1 is computed
+      double scheduledStart = block * blockDuration;
+      if (!freeRunning) {
+        double waitTime = scheduledStart - Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - clockStart);
+        if (waitTime > 0)
+          std::this_thread::sleep_for(std::chrono::duration<double>(waitTime));
+      }
+      auto start = Time::getHighResolutionTicks();
+      host.processBlock(block);
+      auto end = Time::getHighResolutionTicks();
+      blockTimes[(size_t)block] = (float)Time::highResolutionTicksToSeconds(end - start);
+
+      for (int bus = 0; bus < numBuses; bus++) {
+        ChordSnapshot snapshot;
+        ChordBuses::getInstance()->getBus(bus, scope).getChordAt(UnknownPosition, snapshot);
+        if (!(snapshot.chord == lastChords[(size_t)bus])) {
+          lastChords[(size_t)bus] = snapshot.chord;
+          numChordChanges[(size_t)bus]++;
+        }
+      }
+
+      double lateness = freeRunning
+        ? blockTimes[(size_t)block] - blockDuration
+        : Time::highResolutionTicksToSeconds(end - clockStart) - (scheduledStart + blockDuration);
+      if (lateness > 0) {
+        numDeadlineMisses++;
+        maxLateness = jmax(maxLateness, lateness);
+      }
+    }
+
+    std::vector<float> chordTimes, patternTimes;
+    for (int block = 0; block < numBlocks; block++)
+      for (size_t j = 0; j < jobs.size(); j++)
+        (jobs[j].isChordInstance ? chordTimes : patternTimes).push_back(host.processTimes[(size_t)block * jobs.size() + j]);
+
+    std::printf("Times in microseconds:\n");
+    printPercentiles("  chord processBlock", chordTimes);
+    printPercentiles("  pattern processBlock", patternTimes);
+    printPercentiles("  whole block", blockTimes);
+    std::printf("Deadline misses: %d / %d blocks (%.2f%%), worst by %.1f us\n",
+      numDeadlineMisses, numBlocks, 100.0 * numDeadlineMisses / numBlocks, maxLateness * 1e6);
+
+    if (AllocationCounter::isAvailable())
+      std::printf("Allocations in processBlock: %lld\n", (long long)host.numAllocations.load());
+  }
+
+  for (int bus = 0; bus < numBuses; bus++) {
+    auto contention = ChordBuses::getInstance()->getBus(bus, scope).getContention();
+    std::printf("Chord bus %d: %d chord changes seen, %llu contended writes (%.1f us waited), %llu failed read attempts, %llu stale reads, %llu skipped writes\n",
+      bus + 1,
+      numChordChanges[(size_t)bus],
+      (unsigned long long)contention.numContendedWrites,
+      Time::highResolutionTicksToSeconds((int64)contention.writerWaitTicks) * 1e6,
+      (unsigned long long)contention.numFailedReadAttempts,
+      (unsigned long long)contention.numStaleReads,
+      (unsigned long long)contention.numSkippedWrites);
+    // The chord instance has to skip its blocks until it takes the lock over,
+    // and then publish its chords again. Free running, the run may be over
+    // before that
+    if (deadWriter && !freeRunning && (contention.numSkippedWrites == 0 || contention.numContendedWrites == contention.numSkippedWrites))
+      fail("The writer lock of chord bus " + String(bus + 1) + " was not taken over");
+  }
+
+  for (auto& job : jobs)
+    job.processor->releaseResources();
+  return 0;
+}
+
+int main(int argc, char* argv[]) {
+  ScopedJuceInitialiser_GUI juceInit;
+  ArgumentList args(argc, argv);
+  return ConsoleApplication::invokeCatchingFailures([&] { return runStress(args); });
+}
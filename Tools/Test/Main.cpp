@@ -0,0 +1,345 @@
+/*
+  ==============================================================================
+
+    Main.cpp
+
+    ArplignerTest: renders a scripted session (chords, rests and single-note
+    chords, under two pattern tracks) in both modes and with both event
+    timings, with every behaviour for no or a single chord note and every
+    mapping mode, and checks that the output is identical to the golden files
+    of Test/golden. With sample-accurate timing, it also checks that the output
+    doesn't depend on the block size. Without lookahead, when the chord events
+    are one block ahead, it checks that the output doesn't depend on the order
+    the instances are run in either.
+
+    The per-block golden files were rendered by the original version of the
+    plugin (before sample-accurate timing existed), so that the current one is
+    checked to behave exactly like it. Built with ARPLIGNER_TEST_BASELINE, this
+    program renders them again from the sources of that version (see the
+    baseline-golden target of the Makefile)
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "PluginProcessor.h"
+#include "../Common/ToolUtils.h"
+#include "../Common/Rendering.h"
+
+
+static const char* const Usage =
+  "Usage: ArplignerTest [--golden DIR] [--update-golden] [--filter TEXT] [--no-block-sizes]\n"
+  "\n"
+  "  --golden DIR       Where the golden files are (default: Test/golden)\n"
+  "  --update-golden    Writes the golden files instead of comparing with them.\n"
+  "                     Only to be done when a change of the output is intended,\n"
+  "                     and never for the per-block ones\n"
+  "  --filter TEXT      Only runs the configurations whose name contains TEXT\n"
+  "  --no-block-sizes   Doesn't check that the output is the same with block\n"
+  "                     sizes from 1 to 4096 samples\n"
+  "\n"
+  "Exits with an error if any check fails.\n";
+
+// The session is played at 120 bpm and 48 kHz. With that many ticks per
+// quarter note, the golden files are timestamped in samples
+const double SampleRate = 48000;
+const int TicksPerQuarterNote = 24000;
+const int Beat = TicksPerQuarterNote;
+const int ChordChannel = 16;
+// The blocks the golden files are rendered with
+const int ReferenceBlockSize = 512;
+
+
+static void addNote(MidiMessageSequence& seq, int chan, int nn, int start, int end, int vel = 100) {
+  seq.addEvent(MidiMessage::noteOn(chan, nn, (uint8)vel), start);
+  seq.addEvent(MidiMessage::noteOff(chan, nn), end);
+}
+
+// One chord per beat, for two bars. Each kind of chord the behaviours deal
+// with comes up at least twice: rests, single notes, and chords of 3 or more
+// notes (after a chord, after a rest or after a single note). Chords start
+// on the beat or off the grid, and are released exactly when the next one
+// starts, a bit after, or a bit before
+struct ScriptedChord {
+  std::vector<int> notes;
+  int startOffset, endOffset;
+};
+
+static const ScriptedChord Chords[] = {
+  { { 48, 52, 55, 59 }, 0, 0 },
+  { { 45 }, 37, 120 },
+  { {}, 0, 0 },
+  { { 41, 48, 53, 57 }, 0, -300 },
+  { { 43 }, 0, 0 },
+  { { 38 }, 11, 0 },
+  { {}, 0, 0 },
+  { { 43, 47, 50, 53 }, -5, 0 },
+  { { 40, 47, 52, 55, 59 }, 0, 64 },
+  { { 45, 48, 52 }, 700, 0 },
+  { {}, 0, 0 },
+  { { 50 }, 0, 0 },
+  { { 47, 50, 53, 57 }, 1, -1 },
+  { { 48, 55 }, 0, 0 },
+  { {}, 0, 0 },
+  { { 36, 43, 48, 52, 55 }, 0, Beat }
+};
+
+// Timestamped in samples. The chords are on ChordChannel, the patterns on
+// channels 1 and 2
+static RenderSettings makeSession() {
+  RenderSettings settings;
+  settings.chordChannel = ChordChannel;
+  settings.sampleRate = SampleRate;
+
+  const int numBeats = numElementsInArray(Chords);
+  for (int b = 0; b < numBeats; b++) {
+    auto& chord = Chords[b];
+    for (int nn : chord.notes)
+      addNote(settings.chordEvents, ChordChannel, nn, b * Beat + chord.startOffset, (b + 1) * Beat + chord.endOffset);
+  }
+
+  // 16ths over white and black keys, starting with the chords, and a note held
+  // over each rest. The mod wheel moves along
+  static const int ArpNotes[] = { 60, 64, 67, 71, 72, 69, 65, 62, 61, 66, 70, 63, 55, 59, 74, 76 };
+  MidiMessageSequence arp;
+  const int sixteenth = Beat / 4;
+  for (int i = 0; i < numBeats * 4; i++) {
+    int start = i * sixteenth;
+    addNote(arp, 1, ArpNotes[i % 16], start, start + sixteenth / 2, 40 + i);
+    if (i % 4 == 0)
+      arp.addEvent(MidiMessage::controllerEvent(1, 1, i * 2), start);
+  }
+  for (int b = 0; b < numBeats; b++)
+    if (Chords[b].notes.empty())
+      addNote(arp, 1, 48, b * Beat - Beat / 2, b * Beat + Beat / 2);
+
+  // Stabs of three notes on the offbeats, some released by NOTE ONs with a
+  // velocity of 0, and a ratchet of the same note over each single-note chord.
+  // Then a sysex, and an all notes off at the very end
+  MidiMessageSequence stabs;
+  for (int b = 0; b < numBeats; b++) {
+    int start = b * Beat + Beat / 2;
+    for (int nn : { 60, 64, 67 }) {
+      stabs.addEvent(MidiMessage::noteOn(2, nn + b % 3, (uint8)90), start);
+      if (b % 2 == 0)
+        stabs.addEvent(MidiMessage::noteOn(2, nn + b % 3, (uint8)0), start + sixteenth);
+      else
+        stabs.addEvent(MidiMessage::noteOff(2, nn + b % 3), start + sixteenth);
+    }
+    if (Chords[b].notes.size() == 1)
+      for (int r = 0; r < 4; r++)
+        addNote(stabs, 2, 62, b * Beat + r * sixteenth / 2, b * Beat + r * sixteenth / 2 + sixteenth / 4);
+  }
+  const uint8 sysex[] = { 0xf0, 0x7d, 0x01, 0x02, 0xf7 };
+  stabs.addEvent(MidiMessage(sysex, (int)sizeof(sysex)), 3 * Beat + 5);
+  stabs.addEvent(MidiMessage::allNotesOff(2), (numBeats + 1) * Beat);
+
+  arp.sort();
+  stabs.sort();
+  settings.patternEvents.add(arp);
+  settings.patternEvents.add(stabs);
+  return settings;
+}
+
+
+// The SMF the tracks would be saved as: a conductor track with the tempo, then
+// one track per rendered instance
+static MidiFile toMidiFile(const Array<MidiMessageSequence>& tracks) {
+  MidiFile midiFile;
+  midiFile.setTicksPerQuarterNote(TicksPerQuarterNote);
+  MidiMessageSequence conductorTrack;
+  conductorTrack.addEvent(MidiMessage::tempoMetaEvent(500000), 0);
+  midiFile.addTrack(conductorTrack);
+  for (auto& track : tracks)
+    midiFile.addTrack(track);
+  return midiFile;
+}
+
+// The tracks of an SMF written by toMidiFile, without their meta events
+static Array<MidiMessageSequence> readTracks(const MidiFile& midiFile) {
+  Array<MidiMessageSequence> tracks;
+  for (int t = 1; t < midiFile.getNumTracks(); t++) {
+    MidiMessageSequence track;
+    for (auto* holder : *midiFile.getTrack(t))
+      if (!holder->message.isMetaEvent())
+        track.addEvent(holder->message);
+    tracks.add(track);
+  }
+  return tracks;
+}
+
+// The golden files are read back the same way the rendered tracks are, as
+// MidiFile reorders the events that share a timestamp
+static Array<MidiMessageSequence> roundTrip(const Array<MidiMessageSequence>& tracks) {
+  MemoryOutputStream out;
+  toMidiFile(tracks).writeTo(out);
+  MemoryInputStream in(out.getData(), out.getDataSize(), false);
+  MidiFile midiFile;
+  midiFile.readFrom(in);
+  return readTracks(midiFile);
+}
+
+
+struct Configuration {
+  String name;
+  bool multiChannel;
+  bool perBlock;
+  std::vector<std::pair<String, int>> params;
+  // The pattern events are delayed by that many samples (like with the note
+  // delay of a DAW), so that the chord events come that much ahead of them
+  int patternDelay = 0;
+};
+
+// The wraparound settings tried with each mapping mode: none, after all the
+// chord degrees, and a few fixed ones
+const int WraparoundsToCheck[] = { 0, 1, 2, 4, 12 };
+
+static Array<Configuration> makeConfigurations() {
+  Array<Configuration> configs;
+  for (bool perBlock : { true, false }) {
+    String timing = perBlock ? "per-block-" : "sample-accurate-";
+    for (bool multiChannel : { false, true }) {
+      String mode = multiChannel ? "multi-channel" : "multi-instance";
+      for (int w = 0; w <= WhenNoChordNote::LATCH_LAST_CHORD; w++)
+        for (int s = 0; s <= WhenSingleChordNote::TRANSPOSE_LAST_CHORD; s++)
+          configs.add({ timing + mode + "-noChord" + String(w) + "-singleChord" + String(s),
+                        multiChannel, perBlock,
+                        { { "whenNoChordNote", w }, { "whenSingleChordNote", s } } });
+    }
+    // The mappings don't depend on the mode
+    for (int m = 0; m <= PatternNotesMapping::WHITE_NOTE_TO_DEGREE; m++)
+      for (int wrap : WraparoundsToCheck)
+        for (int u = 0; u <= UnmappedNotesBehaviour::PLAY_FULL_CHORD_UP_TO_NOTE; u++)
+          configs.add({ timing + "multi-channel-mapping" + String(m) + "-wraparound" + String(wrap) +
+                          "-unmapped" + String(u),
+                        true, perBlock,
+                        { { "patternNotesMapping", m }, { "patternNotesWraparound", wrap },
+                          { "unmappedNotesBehaviour", u } } });
+  }
+  // Without lookahead, the chord events must already be one block ahead of
+  // the pattern events, and the instances may then be run in any order
+  configs.add({ "sample-accurate-multi-instance-zero-lookahead", false, false,
+                { { "numMillisecsOfLatency", 0 } }, ReferenceBlockSize });
+  return configs;
+}
+
+// Returns whether all the checks passed
+static bool runConfiguration(const Configuration& config, const RenderSettings& session, const File& goldenDir,
+  bool updateGolden, bool checkBlockSizes) {
+  RenderSettings settings = session;
+  settings.multiChannel = config.multiChannel;
+  for (auto& param : config.params)
+    settings.params.add(param);
+  for (auto& events : settings.patternEvents)
+    events.addTimeToMessages(config.patternDelay);
+#if ! ARPLIGNER_TEST_BASELINE
+  settings.params.add({ "eventTiming", config.perBlock ? EventTiming::PER_BLOCK : EventTiming::SAMPLE_ACCURATE });
+#endif
+
+  RenderStats stats;
+  auto tracks = renderTracks(settings, ReferenceBlockSize, stats);
+  File goldenFile = goldenDir.getChildFile(config.name + ".mid");
+
+  if (updateGolden) {
+    goldenFile.deleteFile();
+    FileOutputStream stream(goldenFile);
+    if (!stream.openedOk() || !toMidiFile(tracks).writeTo(stream))
+      fail("Could not write " + goldenFile.getFullPathName());
+    std::cout << config.name << ": written" << std::endl;
+  }
+  else {
+    FileInputStream stream(goldenFile);
+    MidiFile golden;
+    if (!stream.openedOk() || !golden.readFrom(stream)) {
+      std::cout << config.name << ": FAILED, could not read " << goldenFile.getFullPathName() << std::endl;
+      return false;
+    }
+    auto difference = findFirstDifference(readTracks(golden), roundTrip(tracks));
+    if (difference.isNotEmpty()) {
+      std::cout << config.name << ": FAILED, differs from the golden file (" << difference << ")" << std::endl;
+      return false;
+    }
+    // The same events must also give exactly the same file
+    MemoryOutputStream rendered;
+    MemoryBlock goldenData;
+    toMidiFile(tracks).writeTo(rendered);
+    if (!goldenFile.loadFileAsData(goldenData) || goldenData != rendered.getMemoryBlock()) {
+      std::cout << config.name << ": FAILED, not byte for byte the same as the golden file" << std::endl;
+      return false;
+    }
+  }
+
+  if (config.patternDelay > 0) {
+    RenderSettings reordered = settings;
+    reordered.chordInstanceLast = true;
+    auto difference = findFirstDifference(tracks, renderTracks(reordered, ReferenceBlockSize, stats));
+    if (difference.isNotEmpty()) {
+      std::cout << config.name << ": FAILED, differs with the chord instance run last ("
+                << difference << ")" << std::endl;
+      return false;
+    }
+  }
+
+  // In per-block mode, the events are sent at the beginning of their block, so
+  // the output does depend on the block size
+  if (checkBlockSizes && !config.perBlock) {
+    for (int blockSize : BlockSizesToCheck) {
+      if (blockSize == ReferenceBlockSize)
+        continue;
+      auto difference = findFirstDifference(tracks, renderTracks(settings, blockSize, stats));
+      if (difference.isNotEmpty()) {
+        std::cout << config.name << ": FAILED, differs with blocks of " << blockSize << " samples ("
+                  << difference << ")" << std::endl;
+        return false;
+      }
+    }
+  }
+
+  if (!updateGolden)
+    std::cout << config.name << ": ok" << std::endl;
+  return true;
+}
+
+static int runTests(const ArgumentList& args) {
+  if (args.containsOption("--help|-h")) {
+    std::cout << Usage;
+    return 0;
+  }
+
+  File goldenDir = File::getCurrentWorkingDirectory().getChildFile(optionValue(args, "--golden", "Test/golden"));
+  bool updateGolden = args.containsOption("--update-golden");
+  bool checkBlockSizes = !args.containsOption("--no-block-sizes");
+  String filter = args.containsOption("--filter") ? optionValue(args, "--filter") : String();
+  if (updateGolden && !goldenDir.createDirectory())
+    fail("Could not create " + goldenDir.getFullPathName());
+  if (!updateGolden && !goldenDir.isDirectory())
+    fail("No golden files in " + goldenDir.getFullPathName());
+
+  auto session = makeSession();
+  int numRun = 0, numFailed = 0;
+  for (auto& config : makeConfigurations()) {
+    if (!config.name.contains(filter))
+      continue;
+#if ARPLIGNER_TEST_BASELINE
+    // The original version only has per-block timing
+    if (!config.perBlock)
+      continue;
+#endif
+    numRun++;
+    if (!runConfiguration(config, session, goldenDir, updateGolden, checkBlockSizes))
+      numFailed++;
+  }
+
+  if (numRun == 0)
+    fail("No configuration matches '" + filter + "'");
+  if (numFailed > 0)
+    fail(String(numFailed) + " of " + String(numRun) + " configurations failed");
+  std::cout << "All " << numRun << " configurations " << (updateGolden ? "written" : "passed") << std::endl;
+  return 0;
+}
+
+int main(int argc, char* argv[]) {
+  ScopedJuceInitialiser_GUI juceInit;
+  ArgumentList args(argc, argv);
+  return ConsoleApplication::invokeCatchingFailures([&] { return runTests(args); });
+}
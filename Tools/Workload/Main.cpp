@@ -0,0 +1,246 @@
+/*
+  ==============================================================================
+
+    Main.cpp
+
+    ArplignerWorkload: plays a representative session (a chord progression
+    over dense pattern tracks) through the plugin, in both modes and every
+    mapping mode. It is what the Release-PGO build of the plugin is trained
+    on (see "make pgo"), and reports how long the whole note path took
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "PluginProcessor.h"
+#include "../Common/ToolUtils.h"
+
+
+static const char* const Usage =
+  "Usage: ArplignerWorkload [--bars N] [--block-size N] [--sample-rate N]\n"
+  "\n"
+  "  --bars N         Length of the session played with each configuration\n"
+  "                   (default: 4)\n"
+  "  --block-size N   Size of the blocks, in samples (default: 256)\n"
+  "  --sample-rate N  Sample rate, in Hz (default: 48000)\n";
+
+// Multi-channel mode gets the chords on that channel, and the pattern tracks
+// on channels 1, 2 and 3. The chord instance of Multi-instance mode accepts
+// any channel
+const int ChordChannel = 16;
+
+
+// Chord changes every two beats, including a single-note chord and a rest, in
+// voicings of 4 to 7 notes
+static const std::vector<std::vector<int>> Progression = {
+  { 48, 52, 55, 59 },
+  { 45, 52, 57, 60, 64 },
+  { 41, 48, 53, 57, 60, 64, 67 },
+  { 43, 50, 53, 59, 65 },
+  { 40 },
+  {},
+  { 50, 53, 57, 60 },
+  { 43, 47, 50, 53, 57, 59 }
+};
+
+static void addNote(MidiMessageSequence& seq, int chan, int nn, double start, double end, int vel = 100) {
+  seq.addEvent(MidiMessage::noteOn(chan, nn, (uint8)vel), start);
+  seq.addEvent(MidiMessage::noteOff(chan, nn), end);
+}
+
+struct Session {
+  MidiMessageSequence chords;
+  std::vector<MidiMessageSequence> patterns;
+  // Everything together, for Multi-channel mode
+  MidiMessageSequence merged;
+};
+
+// At 120 bpm, with timestamps in samples
+static Session makeSession(int numBars, double sampleRate) {
+  Session session;
+  double beat = sampleRate / 2, eighth = beat / 2, sixteenth = beat / 4, thirtySecond = beat / 8;
+  double sessionEnd = numBars * 4 * beat;
+
+  // Every other chord is played legato: the next one starts a bit before it
+  // is released
+  for (int c = 0; c < numBars * 2; c++) {
+    double start = c * 2 * beat;
+    double end = start + 2 * beat + (c % 2 == 0 ? beat / 16 : -beat / 16);
+    for (int nn : Progression[(size_t)c % Progression.size()])
+      addNote(session.chords, ChordChannel, nn, start, end);
+  }
+
+  // An arpeggio of 16ths over white and black keys, across two octaves, with
+  // the mod wheel moving along
+  static const int ArpNotes[] = { 60, 64, 67, 71, 72, 76, 74, 69, 65, 62, 61, 66, 70, 75, 79, 84 };
+  MidiMessageSequence arp;
+  for (int i = 0; i < numBars * 16; i++) {
+    double start = i * sixteenth;
+    addNote(arp, 1, ArpNotes[i % 16], start, start + sixteenth / 2, 64 + i % 64);
+    arp.addEvent(MidiMessage::controllerEvent(1, 1, (i * 8) % 128), start);
+  }
+
+  // Stabs of four pattern notes on each 8th, and every 4th one a ratchet of
+  // 32nds
+  MidiMessageSequence stabs;
+  for (int i = 0; i < numBars * 8; i++) {
+    double start = i * eighth;
+    if (i % 4 == 3) {
+      for (int r = 0; r < 4; r++)
+        addNote(stabs, 2, 48, start + r * thirtySecond, start + (r + 0.5) * thirtySecond);
+    }
+    else {
+      for (int nn : { 60, 63, 67, 70 })
+        addNote(stabs, 2, nn + (i % 2) * 2, start, start + sixteenth);
+    }
+  }
+
+  // A legato bass line, with pitch bends. The first note of each bar gets a
+  // second NOTE ON and no NOTE OFF in between, like some step sequencers send
+  static const int BassNotes[] = { 36, 43, 48, 36 };
+  MidiMessageSequence bass;
+  for (int i = 0; i < numBars * 8; i++) {
+    double start = i * eighth;
+    int nn = BassNotes[i % 4];
+    addNote(bass, 3, nn, start, start + eighth * 1.25);
+    if (i % 8 == 0)
+      bass.addEvent(MidiMessage::noteOn(3, nn, (uint8)90), start + sixteenth);
+    if (i % 2 == 0)
+      bass.addEvent(MidiMessage::pitchWheel(3, 8192 + (i % 4 == 0 ? 1024 : -1024)), start);
+  }
+
+  session.patterns = { arp, stabs, bass };
+  for (int p = 0; p < (int)session.patterns.size(); p++)
+    session.patterns[(size_t)p].addEvent(MidiMessage::allNotesOff(p + 1), sessionEnd);
+
+  session.merged = session.chords;
+  for (auto& pattern : session.patterns)
+    session.merged.addSequence(pattern, 0);
+  session.merged.sort();
+  return session;
+}
+
+
+// Every mapping mode, with a few wraparounds, every behaviour for unmapped
+// notes, and both event timings. What to do with no or a single chord note
+// only matters at a few chord changes, so those are cycled through
+using Params = Array<std::pair<String, int>>;
+
+static std::vector<Params> makeConfigurations() {
+  std::vector<Params> configs;
+  for (int mapping = 0; mapping <= PatternNotesMapping::WHITE_NOTE_TO_DEGREE; mapping++)
+    for (int wrap : { 0, 1, 2, 7 })
+      for (int unmapped = 0; unmapped <= UnmappedNotesBehaviour::PLAY_FULL_CHORD_UP_TO_NOTE; unmapped++)
+        for (int timing = 0; timing <= EventTiming::SAMPLE_ACCURATE; timing++) {
+          int i = (int)configs.size();
+          Params params;
+          params.add({ "patternNotesMapping", mapping });
+          params.add({ "patternNotesWraparound", wrap });
+          params.add({ "unmappedNotesBehaviour", unmapped });
+          params.add({ "eventTiming", timing });
+          params.add({ "whenNoChordNote", i % 3 });
+          params.add({ "whenSingleChordNote", i % 5 });
+          configs.push_back(params);
+        }
+  return configs;
+}
+
+
+struct Instance {
+  std::unique_ptr<AudioProcessor> processor;
+  const MidiMessageSequence* input = nullptr;
+  int nextInputEvent = 0;
+  int latency = 0;
+};
+
+struct WorkloadStats {
+  int64 numBlocks = 0;
+  int64 numEventsIn = 0;
+  int64 numEventsOut = 0;
+  // Time spent in processBlock
+  double processSeconds = 0;
+};
+
+// Plays the session with fresh instances, the way ArplignerRender does
+static void play(const Session& session, bool multiChannel, const Params& params,
+  int blockSize, double sampleRate, WorkloadStats& stats) {
+  ToolPlayHead playHead;
+  std::vector<Instance> instances(multiChannel ? 1 : session.patterns.size() + 1);
+  for (size_t i = 0; i < instances.size(); i++) {
+    auto& inst = instances[i];
+    inst.processor.reset(createPluginFilter());
+    inst.processor->setPlayHead(&playHead);
+    inst.input = multiChannel ? &session.merged : i == 0 ? &session.chords : &session.patterns[i - 1];
+    for (auto& [paramID, value] : params)
+      setParameter(*inst.processor, paramID, value);
+    setParameter(*inst.processor, "chordChan",
+      multiChannel ? ChordChannel : i == 0 ? InstanceBehaviour::IS_CHORD : InstanceBehaviour::IS_PATTERN);
+    inst.processor->prepareToPlay(sampleRate, blockSize);
+    inst.latency = inst.processor->getLatencySamples();
+  }
+
+  int maxLatency = 0;
+  for (auto& inst : instances)
+    maxLatency = jmax(maxLatency, inst.latency);
+  int64 numSamples = (int64)session.merged.getEndTime() + 1;
+
+  AudioBuffer<float> audio(0, blockSize);
+  MidiBuffer midi;
+  midi.ensureSize(4096);
+  for (int64 blockStart = -maxLatency; blockStart < numSamples; blockStart += blockSize) {
+    stats.numBlocks++;
+    playHead.setTimeInSamples(blockStart);
+    for (auto& inst : instances) {
+      midi.clear();
+      int64 inputStart = blockStart + inst.latency;
+      for (; inst.nextInputEvent < inst.input->getNumEvents(); inst.nextInputEvent++) {
+        auto& msg = inst.input->getEventPointer(inst.nextInputEvent)->message;
+        if (msg.getTimeStamp() >= inputStart + blockSize)
+          break;
+        midi.addEvent(msg, (int)(msg.getTimeStamp() - inputStart));
+        stats.numEventsIn++;
+      }
+      auto start = Time::getHighResolutionTicks();
+      inst.processor->processBlock(audio, midi);
+      stats.processSeconds += Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - start);
+      stats.numEventsOut += midi.getNumEvents();
+    }
+  }
+
+  for (auto& inst : instances)
+    inst.processor->releaseResources();
+}
+
+static int runWorkload(const ArgumentList& args) {
+  if (args.containsOption("--help|-h")) {
+    std::cout << Usage;
+    return 0;
+  }
+
+  int numBars = intOptionValue(args, "--bars", 4, 1, 10000);
+  int blockSize = intOptionValue(args, "--block-size", 256, 1, 1 << 16);
+  double sampleRate = intOptionValue(args, "--sample-rate", 48000, 1000, 1000000);
+
+  auto session = makeSession(numBars, sampleRate);
+  auto configs = makeConfigurations();
+  std::printf("%d bars, %d chord events and %d pattern events per configuration, blocks of %d samples at %g Hz\n",
+    numBars, session.chords.getNumEvents(), session.merged.getNumEvents() - session.chords.getNumEvents(),
+    blockSize, sampleRate);
+
+  for (bool multiChannel : { false, true }) {
+    WorkloadStats stats;
+    for (auto& params : configs)
+      play(session, multiChannel, params, blockSize, sampleRate, stats);
+    std::printf("%-15s %zu configurations, %lld blocks, %lld events in, %lld out, %.1f ms in processBlock (%.1f ns per event in)\n",
+      multiChannel ? "Multi-channel:" : "Multi-instance:", configs.size(), (long long)stats.numBlocks,
+      (long long)stats.numEventsIn, (long long)stats.numEventsOut, stats.processSeconds * 1e3,
+      stats.processSeconds * 1e9 / jmax((int64)1, stats.numEventsIn));
+  }
+  return 0;
+}
+
+int main(int argc, char* argv[]) {
+  ScopedJuceInitialiser_GUI juceInit;
+  ArgumentList args(argc, argv);
+  return ConsoleApplication::invokeCatchingFailures([&] { return runWorkload(args); });
+}